@@ -0,0 +1,414 @@
+#include "belief_propagation.hpp"
+#include "threads.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+using namespace bwabstraction;
+using namespace std;
+
+// max-marginals closer than this are ties, as in opengm's modeFromFactorMarginal()
+#define TIE_TOLERANCE 0.00001f
+// edge key of a factor with a variable without key, never matched
+#define NO_EDGE_KEY 0ull
+
+namespace
+{
+
+inline unsigned long long HashCombine(unsigned long long hash, unsigned long long value)
+{
+    // splitmix64 finalizer of the value, folded into the hash
+    value += 0x9e3779b97f4a7c15ull;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    value ^= value >> 31;
+    return (hash ^ value) * 0x100000001b3ull;
+}
+
+} // namespace
+
+BinaryBeliefPropagation::BinaryBeliefPropagation() :
+    numVariables(0)
+{
+    factorFirst.push_back(0);
+    tableFirst.push_back(0);
+}
+
+void BinaryBeliefPropagation::Reset(int pNumVariables)
+{
+    numVariables = pNumVariables;
+    factorFirst.resize(1);
+    tableFirst.resize(1);
+    tables.clear();
+    edgeVariable.clear();
+    edgeFactor.clear();
+}
+
+void BinaryBeliefPropagation::AddFactor(int pVariable, const float pValues[2])
+{
+    AddFactor(1, &pVariable, pValues);
+}
+
+void BinaryBeliefPropagation::AddFactor(int pVariable0, int pVariable1, const float pValues[4])
+{
+    const int variables[] = { pVariable0, pVariable1 };
+    AddFactor(2, variables, pValues);
+}
+
+void BinaryBeliefPropagation::AddFactor(int pVariable0, int pVariable1, int pVariable2, const float pValues[8])
+{
+    const int variables[] = { pVariable0, pVariable1, pVariable2 };
+    AddFactor(3, variables, pValues);
+}
+
+void BinaryBeliefPropagation::AddFactor(int pArity, const int* pVariables, const float* pValues)
+{
+    const int factor = static_cast<int>(factorFirst.size()) - 1;
+    for (int k = 0; k < pArity; ++k)
+    {
+        edgeVariable.push_back(pVariables[k]);
+        edgeFactor.push_back(factor);
+    }
+    tables.insert(tables.end(), pValues, pValues + (1 << pArity));
+    factorFirst.push_back(static_cast<int>(edgeVariable.size()));
+    tableFirst.push_back(static_cast<int>(tables.size()));
+}
+
+void BinaryBeliefPropagation::BuildAdjacency()
+{
+    // counting sort of the edges by variable, the factor order is kept within a variable
+    const int numEdges = static_cast<int>(edgeVariable.size());
+    variableFirst.assign(numVariables + 1, 0);
+    for (int e = 0; e < numEdges; ++e)
+    {
+        ++variableFirst[edgeVariable[e] + 1];
+    }
+    for (int v = 0; v < numVariables; ++v)
+    {
+        variableFirst[v + 1] += variableFirst[v];
+    }
+    variableEdges.resize(numEdges);
+    vector<int> cursor(variableFirst.begin(), variableFirst.end() - 1);
+    for (int e = 0; e < numEdges; ++e)
+    {
+        variableEdges[cursor[edgeVariable[e]]++] = e;
+    }
+}
+
+/**
+ * @brief BinaryBeliefPropagation::UpdateFactorMessages
+ * Send the messages of a factor to all of its variables, each the maximum of the table plus
+ * the messages of the other variables, normalized to a maximum of 0.
+ */
+void BinaryBeliefPropagation::UpdateFactorMessages(int pFactor)
+{
+    const int first = factorFirst[pFactor];
+    const int arity = factorFirst[pFactor + 1] - first;
+    const float* table = &tables[tableFirst[pFactor]];
+    const float* in = &variableToFactor[first * 2];
+    float* out = &factorToVariable[first * 2];
+    const int numConfigurations = 1 << arity;
+    for (int k = 0; k < arity; ++k)
+    {
+        float best[2] = { -FLT_MAX, -FLT_MAX };
+        for (int c = 0; c < numConfigurations; ++c)
+        {
+            float value = table[c];
+            for (int j = 0; j < arity; ++j)
+            {
+                if (j != k)
+                {
+                    value += in[j * 2 + ((c >> j) & 1)];
+                }
+            }
+            const int x = (c >> k) & 1;
+            best[x] = max(best[x], value);
+        }
+        const float norm = max(best[0], best[1]);
+        out[k * 2] = best[0] - norm;
+        out[k * 2 + 1] = best[1] - norm;
+    }
+}
+
+void BinaryBeliefPropagation::ClearWarmStart()
+{
+    warmStartIndex.clear();
+    warmStartMessages.clear();
+}
+
+/**
+ * @brief BinaryBeliefPropagation::ComputeEdgeKeys
+ * Key every edge by the arity of its factor, the keys of the factor variables and its slot.
+ * Edges of factors with a variable without key get NO_EDGE_KEY.
+ */
+void BinaryBeliefPropagation::ComputeEdgeKeys(const vector<unsigned long long> &pVariableKeys)
+{
+    const int numEdges = static_cast<int>(edgeVariable.size());
+    edgeKeys.resize(numEdges);
+    #pragma omp parallel for
+    for (int e = 0; e < numEdges; ++e)
+    {
+        const int f = edgeFactor[e];
+        bool keyed = true;
+        unsigned long long key = HashCombine(0, factorFirst[f + 1] - factorFirst[f]);
+        for (int j = factorFirst[f]; j < factorFirst[f + 1]; ++j)
+        {
+            keyed = keyed && pVariableKeys[edgeVariable[j]] != NO_VARIABLE_KEY;
+            key = HashCombine(key, pVariableKeys[edgeVariable[j]]);
+        }
+        edgeKeys[e] = keyed ? HashCombine(key, e - factorFirst[f]) : NO_EDGE_KEY;
+    }
+}
+
+void BinaryBeliefPropagation::LoadWarmStart()
+{
+    const int numEdges = static_cast<int>(edgeVariable.size());
+    if (warmStartIndex.empty())
+    {
+        return;
+    }
+    // concurrent lookups only read the map
+    #pragma omp parallel for
+    for (int e = 0; e < numEdges; ++e)
+    {
+        auto it = warmStartIndex.find(edgeKeys[e]);
+        if (edgeKeys[e] == NO_EDGE_KEY || it == warmStartIndex.end() || it->second < 0)
+        {
+            continue;
+        }
+        const float* messages = &warmStartMessages[it->second * 4];
+        factorToVariable[e * 2] = messages[0];
+        factorToVariable[e * 2 + 1] = messages[1];
+        // a variable of one factor never sends, it has to keep sending zero like in a cold
+        // start instead of the sum of the factors it had in the previous model
+        const int v = edgeVariable[e];
+        if (variableFirst[v + 1] - variableFirst[v] > 1)
+        {
+            variableToFactor[e * 2] = messages[2];
+            variableToFactor[e * 2 + 1] = messages[3];
+        }
+    }
+}
+
+void BinaryBeliefPropagation::SaveWarmStart()
+{
+    const int numEdges = static_cast<int>(edgeVariable.size());
+    warmStartIndex.clear();
+    warmStartIndex.reserve(numEdges);
+    warmStartMessages.resize(numEdges * 4);
+    for (int e = 0; e < numEdges; ++e)
+    {
+        if (edgeKeys[e] == NO_EDGE_KEY)
+        {
+            continue;
+        }
+        // an edge key that is not unique can not tell which edge to start from
+        auto inserted = warmStartIndex.insert(make_pair(edgeKeys[e], e));
+        if (!inserted.second)
+        {
+            inserted.first->second = -1;
+        }
+    }
+    #pragma omp parallel for
+    for (int e = 0; e < numEdges; ++e)
+    {
+        float* messages = &warmStartMessages[e * 4];
+        messages[0] = factorToVariable[e * 2];
+        messages[1] = factorToVariable[e * 2 + 1];
+        messages[2] = variableToFactor[e * 2];
+        messages[3] = variableToFactor[e * 2 + 1];
+    }
+}
+
+void BinaryBeliefPropagation::Infer(int pMaxIterations, float pConvergenceBound, vector<int> &pLabels,
+                                    const vector<unsigned long long> *pVariableKeys)
+{
+    const int numFactors = static_cast<int>(factorFirst.size()) - 1;
+    const int numEdges = static_cast<int>(edgeVariable.size());
+    BuildAdjacency();
+    factorToVariable.assign(numEdges * 2, 0.0f);
+    variableToFactor.assign(numEdges * 2, 0.0f);
+    if (pVariableKeys)
+    {
+        ComputeEdgeKeys(*pVariableKeys);
+        LoadWarmStart();
+    }
+
+    // unary factors do not depend on any message and send once
+    #pragma omp parallel for
+    for (int f = 0; f < numFactors; ++f)
+    {
+        if (factorFirst[f + 1] - factorFirst[f] == 1)
+        {
+            UpdateFactorMessages(f);
+        }
+    }
+
+    vector<float> threadDistances(MaxThreads());
+    for (int iteration = 0; iteration < pMaxIterations; ++iteration)
+    {
+        fill(threadDistances.begin(), threadDistances.end(), 0.0f);
+
+        // each variable sends the sum of the messages of its other factors, added up in factor
+        // order like opengm's operateW(), so that the messages are the same to the last bit
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (int v = 0; v < numVariables; ++v)
+        {
+            const int begin = variableFirst[v];
+            const int end = variableFirst[v + 1];
+            if (end - begin < 2)
+            {
+                continue;
+            }
+            float distance = 0.0f;
+            float magnitude = 0.0f;
+            for (int i = begin; i < end; ++i)
+            {
+                float m0 = 0.0f;
+                float m1 = 0.0f;
+                for (int j = begin; j < end; ++j)
+                {
+                    if (j != i)
+                    {
+                        const float* in = &factorToVariable[variableEdges[j] * 2];
+                        m0 += in[0];
+                        m1 += in[1];
+                    }
+                }
+                float* out = &variableToFactor[variableEdges[i] * 2];
+                distance = max(distance, max(fabs(m0 - out[0]), fabs(m1 - out[1])));
+                magnitude = max(magnitude, max(max(fabs(m0), fabs(m1)), max(fabs(out[0]), fabs(out[1]))));
+                out[0] = m0;
+                out[1] = m1;
+            }
+            // relative to the messages of the variable, whose scale varies with the patch areas
+            float &threadDistance = threadDistances[ThreadNum()];
+            threadDistance = max(threadDistance, magnitude > 0.0f ? distance / magnitude : 0.0f);
+        }
+
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (int f = 0; f < numFactors; ++f)
+        {
+            if (factorFirst[f + 1] - factorFirst[f] > 1)
+            {
+                UpdateFactorMessages(f);
+            }
+        }
+
+        // an unchanged round of variable messages reproduces the same factor messages
+        if (*max_element(threadDistances.begin(), threadDistances.end()) < pConvergenceBound)
+        {
+            break;
+        }
+    }
+
+    if (pVariableKeys)
+    {
+        SaveWarmStart();
+    }
+    Decode(pLabels);
+}
+
+void BinaryBeliefPropagation::Belief(int pVariable, float pBelief[2]) const
+{
+    pBelief[0] = pBelief[1] = 0.0f;
+    for (int i = variableFirst[pVariable]; i < variableFirst[pVariable + 1]; ++i)
+    {
+        const float* in = &factorToVariable[variableEdges[i] * 2];
+        pBelief[0] += in[0];
+        pBelief[1] += in[1];
+    }
+}
+
+/**
+ * @brief BinaryBeliefPropagation::DecodeFromFactors
+ * The best label of a variable given the labels already decoded, from the sum over its factors
+ * of the factor marginals maximized over the variables that are still open.
+ */
+int BinaryBeliefPropagation::DecodeFromFactors(int pVariable, const vector<int> &pLabels) const
+{
+    float sum[2] = { 0.0f, 0.0f };
+    for (int i = variableFirst[pVariable]; i < variableFirst[pVariable + 1]; ++i)
+    {
+        const int f = edgeFactor[variableEdges[i]];
+        const int first = factorFirst[f];
+        const int arity = factorFirst[f + 1] - first;
+        const int k = variableEdges[i] - first;
+        const float* table = &tables[tableFirst[f]];
+        const float* in = &variableToFactor[first * 2];
+        float best[2] = { -FLT_MAX, -FLT_MAX };
+        for (int c = 0; c < (1 << arity); ++c)
+        {
+            bool consistent = true;
+            float value = table[c];
+            for (int j = 0; j < arity; ++j)
+            {
+                const int x = (c >> j) & 1;
+                const int label = pLabels[edgeVariable[first + j]];
+                consistent = consistent && (j == k || label < 0 || label == x);
+                value += in[j * 2 + x];
+            }
+            if (consistent)
+            {
+                const int x = (c >> k) & 1;
+                best[x] = max(best[x], value);
+            }
+        }
+        sum[0] += best[0];
+        sum[1] += best[1];
+    }
+    return sum[1] > sum[0] ? 1 : 0;
+}
+
+void BinaryBeliefPropagation::Decode(vector<int> &pLabels) const
+{
+    pLabels.assign(numVariables, -1);
+    vector<int> waiting;
+    for (int v = 0; v < numVariables; ++v)
+    {
+        float belief[2];
+        Belief(v, belief);
+        if (fabs(belief[1] - belief[0]) >= TIE_TOLERANCE)
+        {
+            pLabels[v] = belief[1] > belief[0] ? 1 : 0;
+            waiting.push_back(v);
+        }
+    }
+
+    // spread the decoded labels to the open variables of their factors, depth first,
+    // and start again from the next open variable whenever no decoded neighbour is left
+    int next = 0;
+    while (next < numVariables)
+    {
+        while (!waiting.empty())
+        {
+            const int v = waiting.back();
+            waiting.pop_back();
+            for (int i = variableFirst[v]; i < variableFirst[v + 1]; ++i)
+            {
+                const int f = edgeFactor[variableEdges[i]];
+                for (int e = factorFirst[f]; e < factorFirst[f + 1]; ++e)
+                {
+                    const int v2 = edgeVariable[e];
+                    if (pLabels[v2] < 0)
+                    {
+                        pLabels[v2] = DecodeFromFactors(v2, pLabels);
+                        waiting.push_back(v2);
+                        break;
+                    }
+                }
+            }
+        }
+        while (next < numVariables && pLabels[next] >= 0)
+        {
+            ++next;
+        }
+        if (next < numVariables)
+        {
+            float belief[2];
+            Belief(next, belief);
+            pLabels[next] = belief[1] > belief[0] ? 1 : 0;
+            waiting.push_back(next);
+        }
+    }
+}
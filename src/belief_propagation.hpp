@@ -0,0 +1,90 @@
+#ifndef BELIEF_PROPAGATION_H
+#define BELIEF_PROPAGATION_H
+
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+// variable key of Infer() for a variable whose factors start from zero
+#define NO_VARIABLE_KEY 0ull
+
+namespace bwabstraction
+{
+
+/**
+ * @brief The BinaryBeliefPropagation class maximizes a sum of factors over binary variables
+ * with loopy max-sum belief propagation. Factors have one, two or three variables and are
+ * given as tables indexed by x0 + 2 * x1 + 4 * x2.
+ *
+ * It reproduces opengm's MessagePassing with BeliefPropagationUpdateRules, Maximizer and
+ * Adder in the parallel (flooding) schedule: all variable to factor messages are updated from
+ * the previous factor messages, then all factor to variable messages, so both halves of an
+ * iteration are data-parallel. Factor messages are normalized to a maximum of 0. The labels
+ * are decoded like opengm's modeFromFactorMarginal(): variables with a clear max-marginal are
+ * fixed first and the ties are resolved greedily from the factor marginals of their neighbours.
+ *
+ * The model is kept in flat arrays that are reused by the next Reset().
+ *
+ * Infer() with keys that identify the variables across models keeps its final messages, and
+ * the next Infer() with keys starts from them instead of from zero. A message is carried over
+ * to a factor of the same arity with the same variable keys, so a model that changed little
+ * converges in a few iterations. Keys must be unique, factors whose keys appear twice start
+ * from zero.
+ */
+class BinaryBeliefPropagation
+{
+
+public:
+
+    BinaryBeliefPropagation();
+
+    // remove all factors and set the number of variables
+    void Reset(int pNumVariables);
+    void AddFactor(int pVariable, const float pValues[2]);
+    void AddFactor(int pVariable0, int pVariable1, const float pValues[4]);
+    void AddFactor(int pVariable0, int pVariable1, int pVariable2, const float pValues[8]);
+
+    // stops after pMaxIterations or once no message changes by pConvergenceBound or more,
+    // relative to the largest message of its variable. pVariableKeys enables the warm start,
+    // one key per variable, NO_VARIABLE_KEY for variables that can not be matched.
+    void Infer(int pMaxIterations, float pConvergenceBound, std::vector<int> &pLabels,
+               const std::vector<unsigned long long> *pVariableKeys = NULL);
+    // forget the messages kept for the warm start
+    void ClearWarmStart(void);
+
+private:
+
+    void AddFactor(int pArity, const int* pVariables, const float* pValues);
+    void BuildAdjacency(void);
+    void ComputeEdgeKeys(const std::vector<unsigned long long> &pVariableKeys);
+    void LoadWarmStart(void);
+    void SaveWarmStart(void);
+    void UpdateFactorMessages(int pFactor);
+    void Belief(int pVariable, float pBelief[2]) const;
+    int DecodeFromFactors(int pVariable, const std::vector<int> &pLabels) const;
+    void Decode(std::vector<int> &pLabels) const;
+
+    int numVariables;
+    // factor f owns the edges [factorFirst[f], factorFirst[f + 1]), one per variable in order,
+    // and the table entries [tableFirst[f], tableFirst[f] + 2^arity)
+    std::vector<int> factorFirst;
+    std::vector<int> tableFirst;
+    std::vector<float> tables;
+    std::vector<int> edgeVariable;
+    std::vector<int> edgeFactor;
+    // edges of variable v in factor order are variableEdges[variableFirst[v], variableFirst[v + 1])
+    std::vector<int> variableFirst;
+    std::vector<int> variableEdges;
+    // two values per edge
+    std::vector<float> factorToVariable;
+    std::vector<float> variableToFactor;
+    // messages of the previous Infer() with keys, four values (both directions) per edge key
+    std::vector<unsigned long long> edgeKeys;
+    std::unordered_map<unsigned long long, int> warmStartIndex;
+    std::vector<float> warmStartMessages;
+
+};
+
+} // namespace bwabstraction
+
+#endif // BELIEF_PROPAGATION_H
@@ -0,0 +1,271 @@
+#include "binary_mesh.hpp"
+#include <cstdint>
+#include <cstring>
+
+using namespace bwabstraction;
+using namespace std;
+
+// bump whenever the layout changes
+#define BINARY_MESH_VERSION 2
+#define BINARY_MESH_BYTE_ORDER 0x01020304u
+
+#define BINARY_MESH_COMPONENT_IDS 1u
+#define BINARY_MESH_SHARP_EDGES 2u
+
+namespace
+{
+
+typedef struct _BinaryMeshHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t flags;
+    uint32_t vertexCount;
+    uint32_t faceCount;
+    uint32_t componentCount;
+    uint32_t sharpEdgeCount;
+    uint32_t reserved;
+} BinaryMeshHeader;
+
+const char binaryMeshMagic[8] = { 'B', 'W', 'A', 'M', 'E', 'S', 'H', '\0' };
+
+} // namespace
+
+BinaryMesh::BinaryMesh() :
+    vertexCount(0),
+    faceCount(0),
+    componentCount(0),
+    sharpEdgeCount(0),
+    positions(NULL),
+    indices(NULL),
+    faceNormals(NULL),
+    componentIDs(NULL),
+    sharpEdges(NULL),
+    sharpEdgeCosines(NULL)
+{
+}
+
+/**
+ * @brief BinaryMesh::Open
+ * Map a .bwm file and check its header, size and indices.
+ * @return false if the file is missing or not a valid .bwm file of this version.
+ */
+bool BinaryMesh::Open(const string &pFilePath)
+{
+    if (!file.Open(pFilePath) || file.size < sizeof(BinaryMeshHeader))
+    {
+        return false;
+    }
+
+    BinaryMeshHeader header;
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, binaryMeshMagic, sizeof(binaryMeshMagic)) != 0 ||
+        header.version != BINARY_MESH_VERSION ||
+        header.byteOrder != BINARY_MESH_BYTE_ORDER ||
+        header.vertexCount > INT32_MAX || header.faceCount > INT32_MAX / 3 ||
+        header.sharpEdgeCount > INT32_MAX / 6)
+    {
+        return false;
+    }
+    const bool withComponentIDs = (header.flags & BINARY_MESH_COMPONENT_IDS) != 0;
+    const bool withSharpEdges = (header.flags & BINARY_MESH_SHARP_EDGES) != 0;
+
+    const size_t positionsBytes = Align8(static_cast<size_t>(header.vertexCount) * 3 * sizeof(float));
+    const size_t indicesBytes = Align8(static_cast<size_t>(header.faceCount) * 3 * sizeof(unsigned int));
+    const size_t normalsBytes = Align8(static_cast<size_t>(header.faceCount) * 3 * sizeof(float));
+    const size_t componentIDsBytes = withComponentIDs ? Align8(static_cast<size_t>(header.faceCount) * sizeof(unsigned int)) : 0;
+    const size_t sharpEdgesBytes = withSharpEdges ? Align8(static_cast<size_t>(header.sharpEdgeCount) * 6 * sizeof(float)) : 0;
+    const size_t cosinesBytes = withSharpEdges ? Align8(static_cast<size_t>(header.sharpEdgeCount) * sizeof(float)) : 0;
+    const size_t expectedSize = Align8(sizeof(BinaryMeshHeader)) + positionsBytes + indicesBytes +
+        normalsBytes + componentIDsBytes + sharpEdgesBytes + cosinesBytes;
+    if (file.size != expectedSize)
+    {
+        return false;
+    }
+
+    const char* cursor = file.data + Align8(sizeof(BinaryMeshHeader));
+    positions = reinterpret_cast<const float*>(cursor);
+    cursor += positionsBytes;
+    indices = reinterpret_cast<const unsigned int*>(cursor);
+    cursor += indicesBytes;
+    faceNormals = reinterpret_cast<const float*>(cursor);
+    cursor += normalsBytes;
+    componentIDs = withComponentIDs ? reinterpret_cast<const unsigned int*>(cursor) : NULL;
+    cursor += componentIDsBytes;
+    sharpEdges = withSharpEdges ? reinterpret_cast<const float*>(cursor) : NULL;
+    cursor += sharpEdgesBytes;
+    sharpEdgeCosines = withSharpEdges ? reinterpret_cast<const float*>(cursor) : NULL;
+
+    vertexCount = static_cast<int>(header.vertexCount);
+    faceCount = static_cast<int>(header.faceCount);
+    componentCount = withComponentIDs ? static_cast<int>(header.componentCount) : 0;
+    sharpEdgeCount = withSharpEdges ? static_cast<int>(header.sharpEdgeCount) : 0;
+
+    // out of range values would index outside of the mesh later
+    bool valid = true;
+    const int numIndices = faceCount * 3;
+    #pragma omp parallel for reduction(&&:valid)
+    for (int i = 0; i < numIndices; ++i)
+    {
+        valid = valid && indices[i] < header.vertexCount;
+    }
+    if (withComponentIDs)
+    {
+        #pragma omp parallel for reduction(&&:valid)
+        for (int f = 0; f < faceCount; ++f)
+        {
+            valid = valid && componentIDs[f] >= 1 && componentIDs[f] <= header.componentCount;
+        }
+    }
+    if (!valid)
+    {
+        positions = faceNormals = sharpEdges = sharpEdgeCosines = NULL;
+        indices = componentIDs = NULL;
+    }
+    return valid;
+}
+
+bool BinaryMesh::IsOpen() const
+{
+    return positions != NULL;
+}
+
+int BinaryMesh::VertexCount() const
+{
+    return vertexCount;
+}
+
+int BinaryMesh::FaceCount() const
+{
+    return faceCount;
+}
+
+const float* BinaryMesh::Positions() const
+{
+    return positions;
+}
+
+const unsigned int* BinaryMesh::Indices() const
+{
+    return indices;
+}
+
+const float* BinaryMesh::FaceNormals() const
+{
+    return faceNormals;
+}
+
+bool BinaryMesh::HasComponentIDs() const
+{
+    return componentIDs != NULL;
+}
+
+int BinaryMesh::ComponentCount() const
+{
+    return componentCount;
+}
+
+const unsigned int* BinaryMesh::ComponentIDs() const
+{
+    return componentIDs;
+}
+
+bool BinaryMesh::HasSharpEdges() const
+{
+    return sharpEdges != NULL;
+}
+
+int BinaryMesh::SharpEdgeCount() const
+{
+    return sharpEdgeCount;
+}
+
+const float* BinaryMesh::SharpEdges() const
+{
+    return sharpEdges;
+}
+
+const float* BinaryMesh::SharpEdgeCosines() const
+{
+    return sharpEdgeCosines;
+}
+
+/**
+ * @brief BinaryMesh::Write
+ * Static function. Write a mesh as a .bwm file.
+ * @param pMesh A normalized triangle mesh with face normals.
+ * @param pComponentIDs The component ID of each face, empty to leave them out.
+ * @param pComponentCount The number of components.
+ * @param pSharpEdges The edge segments of BWAbstraction::ComputeSharpEdges(), NULL to leave them out.
+ * @param pSharpEdgeCosines The cosine of the dihedral angle of each edge in pSharpEdges.
+ * @param pSharpEdgeCount The number of edges in pSharpEdges.
+ * @return false if the file could not be written.
+ */
+bool BinaryMesh::Write(const string &pFilePath, TriMesh *pMesh,
+                       const vector<unsigned int> &pComponentIDs, int pComponentCount,
+                       const float* pSharpEdges, const float* pSharpEdgeCosines, int pSharpEdgeCount)
+{
+    BinaryMeshHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, binaryMeshMagic, sizeof(binaryMeshMagic));
+    header.version = BINARY_MESH_VERSION;
+    header.byteOrder = BINARY_MESH_BYTE_ORDER;
+    header.vertexCount = static_cast<uint32_t>(pMesh->n_vertices());
+    header.faceCount = static_cast<uint32_t>(pMesh->n_faces());
+    if (!pComponentIDs.empty())
+    {
+        header.flags |= BINARY_MESH_COMPONENT_IDS;
+        header.componentCount = static_cast<uint32_t>(pComponentCount);
+    }
+    if (pSharpEdges && pSharpEdgeCosines)
+    {
+        header.flags |= BINARY_MESH_SHARP_EDGES;
+        header.sharpEdgeCount = static_cast<uint32_t>(pSharpEdgeCount);
+    }
+
+    vector<float> positions;
+    positions.reserve(pMesh->n_vertices() * 3);
+    for(TriMesh::VertexIter vit = pMesh->vertices_begin(); vit != pMesh->vertices_end(); ++vit)
+    {
+        const TriMesh::Point &p = pMesh->point(*vit);
+        positions.push_back(static_cast<float>(p[0]));
+        positions.push_back(static_cast<float>(p[1]));
+        positions.push_back(static_cast<float>(p[2]));
+    }
+    vector<unsigned int> indices;
+    vector<float> faceNormals;
+    indices.reserve(pMesh->n_faces() * 3);
+    faceNormals.reserve(pMesh->n_faces() * 3);
+    for(TriMesh::FaceIter fit = pMesh->faces_begin(); fit != pMesh->faces_end(); ++fit)
+    {
+        for(TriMesh::FaceVertexIter fvit = pMesh->fv_iter(*fit); fvit.is_valid(); ++fvit)
+        {
+            indices.push_back(static_cast<unsigned int>(fvit->idx()));
+        }
+        const TriMesh::Normal &n = pMesh->normal(*fit);
+        faceNormals.push_back(static_cast<float>(n[0]));
+        faceNormals.push_back(static_cast<float>(n[1]));
+        faceNormals.push_back(static_cast<float>(n[2]));
+    }
+
+    ofstream out(pFilePath.c_str(), ios::binary | ios::trunc);
+    if (!out.is_open())
+    {
+        return false;
+    }
+    WriteAligned8(out, &header, 1);
+    WriteAligned8(out, positions.data(), positions.size());
+    WriteAligned8(out, indices.data(), indices.size());
+    WriteAligned8(out, faceNormals.data(), faceNormals.size());
+    if (!pComponentIDs.empty())
+    {
+        WriteAligned8(out, pComponentIDs.data(), pComponentIDs.size());
+    }
+    if (pSharpEdges && pSharpEdgeCosines)
+    {
+        WriteAligned8(out, pSharpEdges, static_cast<size_t>(pSharpEdgeCount) * 6);
+        WriteAligned8(out, pSharpEdgeCosines, static_cast<size_t>(pSharpEdgeCount));
+    }
+    return out.good();
+}
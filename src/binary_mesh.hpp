@@ -0,0 +1,72 @@
+#ifndef BINARYMESH_H
+#define BINARYMESH_H
+
+#include <string>
+#include <vector>
+#include "mapped_file.hpp"
+#include "trimesh.hpp"
+
+namespace bwabstraction
+{
+
+/**
+ * @brief The BinaryMesh class reads and writes .bwm files, a normalized triangle mesh in the
+ * layout the renderer uses: float32 positions, uint32 indices and float32 face normals,
+ * optionally followed by the 1-based component ID of each face and the interior edge segments
+ * sorted by the cosine of their dihedral angle, see BWAbstraction::ComputeSharpEdges().
+ * The file is mapped into memory and the arrays are used in place, in native byte order and
+ * aligned to 8 bytes.
+ */
+class BinaryMesh
+{
+
+public:
+
+    BinaryMesh();
+
+    bool Open(const std::string &pFilePath);
+    bool IsOpen() const;
+
+    int VertexCount() const;
+    int FaceCount() const;
+    // xyz per vertex
+    const float* Positions() const;
+    // three vertex indices per face
+    const unsigned int* Indices() const;
+    // xyz per face
+    const float* FaceNormals() const;
+
+    bool HasComponentIDs() const;
+    int ComponentCount() const;
+    const unsigned int* ComponentIDs() const;
+
+    bool HasSharpEdges() const;
+    int SharpEdgeCount() const;
+    // two endpoints (xyz) per edge
+    const float* SharpEdges() const;
+    // one ascending cosine per edge
+    const float* SharpEdgeCosines() const;
+
+    static bool Write(const std::string &pFilePath, TriMesh *pMesh,
+                      const std::vector<unsigned int> &pComponentIDs, int pComponentCount,
+                      const float* pSharpEdges, const float* pSharpEdgeCosines, int pSharpEdgeCount);
+
+private:
+
+    MappedFile file;
+    int vertexCount;
+    int faceCount;
+    int componentCount;
+    int sharpEdgeCount;
+    const float* positions;
+    const unsigned int* indices;
+    const float* faceNormals;
+    const unsigned int* componentIDs;
+    const float* sharpEdges;
+    const float* sharpEdgeCosines;
+
+};
+
+} // namespace bwabstraction
+
+#endif // BINARYMESH_H
@@ -1,19 +1,32 @@
 #include "bwabstraction.hpp"
 #include "mesh_segmentation.hpp"
+#include "congruency.hpp"
+#include "precompute_cache.hpp"
+#include "binary_mesh.hpp"
+#include "belief_propagation.hpp"
 #include <vector>
 #include <utility>
 #include <algorithm>
 #include <queue>
 #include <cmath>
+#include <climits>
 #include <fstream>
 #include <Eigen/Eigen>
 #include <GL/glew.h>
-#include <GLFW/glfw3.h>
+#include "glcontext.hpp"
+#include "software_rasterizer.hpp"
+#include "surface_labeling.hpp"
+#include "unionfind.hpp"
 #include "glutils.hpp"
 #include "trimesh.hpp"
 #include "rendertarget.hpp"
 #include "standardshader.hpp"
 #include "timer.hpp"
+#include "threads.hpp"
+#include <mutex>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #if USE_EMBEDDED_SHADER
 #include "shaders/shaders.hpp"
@@ -26,7 +39,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 // undef max/min macros defined in minwindef.h.
-// these macros will break the codes in opengm.
+// these macros will break std::max and std::min.
 #ifdef max
     #undef max
 #endif
@@ -34,34 +47,27 @@
     #undef min
 #endif
 
-#ifdef _MSC_VER
-
-// disable C4267 and C4244 (conversion possible loss of data warning) for OpenGM modules
-#pragma warning(push)
-#pragma warning(disable:4267)
-#pragma warning(disable:4244)
-#include <opengm/graphicalmodel/space/simplediscretespace.hxx>
-#include <opengm/operations/adder.hxx>
-#include <opengm/graphicalmodel/graphicalmodel.hxx>
-#include <opengm/inference/messagepassing/messagepassing.hxx>
-#pragma warning(pop) 
-
-#else
-
-#include <opengm/graphicalmodel/space/simplediscretespace.hxx>
-#include <opengm/operations/adder.hxx>
-#include <opengm/graphicalmodel/graphicalmodel.hxx>
-#include <opengm/inference/messagepassing/messagepassing.hxx>
-
-#endif
-
 #define PIXEL(mat, type, row, col) (*(mat.ptr<type>(row)+col))
+// the maps are continuous, so a pixel can also be addressed by its offset row * cols + col
+#define PIXEL_OFFSET(mat, type, offset) (*(mat.ptr<type>()+(offset)))
+// glPolygonOffset() of the depth the sharp edges are tested against, in both rasterizers
+#define POLYGON_OFFSET_FACTOR 5.0f
+#define POLYGON_OFFSET_UNITS 5.0f
+// similarity sets with more patches are tied together by an auxiliary node instead of pairwise.
+// 32 patches are 496 pairwise factors, about as many as the boundaries of a whole view.
+#define SIMILARITY_STAR_SIZE 32
+// convergence bound of the incremental optimization, relative to the messages of each node
+#define INCREMENTAL_CONVERGENCE_BOUND 1e-3f
 
 using namespace bwabstraction;
 using namespace cv;
 using namespace std;
 using namespace Eigen;
-using namespace opengm;
+
+// GLEW keeps its function pointers in globals shared by all instances
+static std::mutex glewMutex;
+// the GL library the pointers were loaded from: -1 none yet, 0 the system one, 1 OSMesa
+static int glewLibrary = -1;
 
 void GetDistinctColor(int id, unsigned char rgb[])
 {
@@ -134,60 +140,228 @@ void _Parameters::LoadMVPMatrixFromFile(string file)
         }
     }
 
-StandardVertexAttribute CreateVertexAttrFromMesh(TriMesh *mesh)
-{
-    vector<float> vertices;
-    vector<float> normals;
-    vector<float> empty;
-    vector<unsigned int> indices;
-    mesh->GetMeshData(vertices, normals, indices);
-    StandardVertexAttribute attr;
-    attr.Create();
-    attr.BufferData(vertices, normals, empty, empty, indices);
-    return attr;
-}
-
-StandardVertexAttribute CreateVertexAttrFromLines(vector<float> &lines)
-{
-    // every 6 float form a (x1, y1, z1) <-> (x2, y2, z2) line segment
-    vector<float> empty;
-    vector<unsigned int> emptyIndices;
-    StandardVertexAttribute attr;
-    attr.Create();
-    attr.BufferData(lines, empty, empty, empty, emptyIndices);
-    return attr;
-}
-
 BWAbstraction::BWAbstraction() :
     mesh(NULL),
+    componentCount(0),
+    precomputeCache(NULL),
+    sharpEdges(NULL),
+    sharpEdgeCosines(NULL),
+    numSharpEdges(0),
+    sharpEdgeCount(0),
+    surfaceFaceVertices(NULL),
+    glContext(NULL),
     glInitialized(false),
-    glResourceInitialized(false)
+    glResourceInitialized(false),
+    glResourceOnHostContext(false),
+    sharpEdgeLineTarget(NULL),
+    triangleIDTarget(NULL),
+    patchIDTarget(NULL),
+    lineMapTarget(NULL),
+    outputTarget(NULL),
+    featureLineShader(NULL),
+    triangleIDShader(NULL),
+    hairlineShader(NULL),
+    labelSSBO(0),
+    meshAttribute(NULL),
+    sharpEdgeAttribute(NULL),
+    modelBuffersDirty(false),
+    savedNumThreads(0)
 {
     mesh = new TriMesh();
+    softwareRasterizer = new SoftwareRasterizer();
+    surfaceLabeling = new SurfaceLabeling();
+    beliefPropagation = new BinaryBeliefPropagation();
+}
+
+BWAbstraction::~BWAbstraction()
+{
+    // only the own context is made current here, the host context is current already
+    if (glResourceInitialized && glResourceOnHostContext)
+    {
+        ReleaseGLResources();
+    }
+    else if (glResourceInitialized && glContext && glContext->MakeCurrent())
+    {
+        ReleaseGLResources();
+        glContext->DoneCurrent();
+    }
+    delete glContext;
+    delete mesh;
+    delete softwareRasterizer;
+    delete surfaceLabeling;
+    delete beliefPropagation;
+    delete precomputeCache;
 }
 
 bool BWAbstraction::LoadModel(string modelFilePath, bwabstraction::Parameters param)
 {
     this->param = param;
+    ScopedMaxThreads threads(this->param.numThreads);
     ::Timer timer;
     if (this->param.verbose)
     {
         timer.Start();
     }
+    beliefPropagation->ClearWarmStart();
+    viewComputed = false;
+
+    // drop the arrays of the previous model and unmap its cache
+    sharpEdges = sharpEdgeCosines = NULL;
+    surfaceFaceVertices = NULL;
+    numSharpEdges = sharpEdgeCount = 0;
+    vector<float>().swap(sharpEdgeStorage);
+    vector<float>().swap(sharpEdgeCosineStorage);
+    vector<int>().swap(surfaceFaceVertexStorage);
+    delete precomputeCache;
+    precomputeCache = NULL;
 
-    if (!mesh->LoadOBJ(modelFilePath))
+    // .bwm files are used in place, OBJ files are parsed
+    BinaryMesh binaryMesh;
+    string extension = modelFilePath.size() >= 4 ? modelFilePath.substr(modelFilePath.size() - 4) : "";
+    transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension == ".bwm")
+    {
+        if (!binaryMesh.Open(modelFilePath) || !mesh->LoadBWM(binaryMesh))
+        {
+            cout << "LoadBWM() failed." << endl;
+            return false;
+        }
+    }
+    else if (!mesh->LoadOBJ(modelFilePath))
     {
         cout << "LoadOBJ() failed." << endl;
         return false;
     }
 
+    // both loaders normalize the mesh already
     renderCount = 0;
-    mesh->Normalize();
     mesh->add_property(meshFPropComponentID);
-    components = MeshSegmentation::ComponentSegmentation(mesh, meshFPropComponentID);
-    ComputeCongruencies();
-    ComputeSharpEdges();
-    ComputeSurfaceConnect();
+    components.clear();
+
+    auto getMeshData = [&]()
+    {
+        if (binaryMesh.IsOpen())
+        {
+            // the float positions and the indices of the file are what GetMeshData() returns
+            meshVertices.assign(binaryMesh.Positions(), binaryMesh.Positions() + binaryMesh.VertexCount() * 3);
+            meshIndices.assign(binaryMesh.Indices(), binaryMesh.Indices() + binaryMesh.FaceCount() * 3);
+        }
+        else
+        {
+            vector<float> normals;
+            mesh->GetMeshData(meshVertices, normals, meshIndices);
+        }
+    };
+
+    unsigned long long meshHash = 0;
+    string cacheFilePath;
+    if (!this->param.cacheDirectory.empty())
+    {
+        meshHash = PrecomputeCache::HashMesh(mesh);
+        cacheFilePath = PrecomputeCache::FilePath(this->param.cacheDirectory, meshHash, this->param.congruentThreshold);
+        precomputeCache = new PrecomputeCache();
+        if (!precomputeCache->Open(cacheFilePath, mesh, meshHash, this->param.congruentThreshold))
+        {
+            delete precomputeCache;
+            precomputeCache = NULL;
+        }
+    }
+
+    if (precomputeCache)
+    {
+        // the components themselves are only needed to find the congruencies, which are cached.
+        // the other arrays are used in place, the mapping stays open until the next LoadModel().
+        const unsigned int* componentIDs = precomputeCache->FaceComponentIDs();
+        const int numFaces = precomputeCache->FaceCount();
+        #pragma omp parallel for
+        for (int i = 0; i < numFaces; ++i)
+        {
+            mesh->property(meshFPropComponentID, TriMesh::FaceHandle(i)) = componentIDs[i];
+        }
+        componentCount = precomputeCache->ComponentCount();
+        precomputeCache->GetCongruencies(congruencies);
+        sharpEdges = precomputeCache->SharpEdges();
+        sharpEdgeCosines = precomputeCache->SharpEdgeCosines();
+        numSharpEdges = precomputeCache->SharpEdgeCount();
+        surfaceFaceVertices = precomputeCache->SurfaceFaceVertices();
+        getMeshData();
+        if (this->param.verbose)
+        {
+            cout << "Precompute loaded from " << cacheFilePath << endl;
+        }
+    }
+    else
+    {
+        // every stage is data-parallel on its own. they run one after another, inside parallel
+        // sections their loops would only get one thread since nesting is not enabled.
+        if (binaryMesh.HasComponentIDs())
+        {
+            const unsigned int* componentIDs = binaryMesh.ComponentIDs();
+            const int numFaces = binaryMesh.FaceCount();
+            #pragma omp parallel for
+            for (int i = 0; i < numFaces; ++i)
+            {
+                mesh->property(meshFPropComponentID, TriMesh::FaceHandle(i)) = componentIDs[i];
+            }
+            components = MeshSegmentation::SplitComponents(mesh, meshFPropComponentID, binaryMesh.ComponentCount());
+        }
+        else
+        {
+            components = MeshSegmentation::ComponentSegmentation(mesh, meshFPropComponentID);
+        }
+        if (binaryMesh.HasSharpEdges())
+        {
+            // binaryMesh is closed when LoadModel() returns
+            sharpEdgeStorage.assign(binaryMesh.SharpEdges(), binaryMesh.SharpEdges() + binaryMesh.SharpEdgeCount() * 6);
+            sharpEdgeCosineStorage.assign(binaryMesh.SharpEdgeCosines(), binaryMesh.SharpEdgeCosines() + binaryMesh.SharpEdgeCount());
+        }
+        else
+        {
+            ComputeSharpEdges();
+        }
+        sharpEdges = sharpEdgeStorage.data();
+        sharpEdgeCosines = sharpEdgeCosineStorage.data();
+        numSharpEdges = static_cast<int>(sharpEdgeCosineStorage.size());
+        ComputeSurfaceConnect();
+        surfaceFaceVertices = surfaceFaceVertexStorage.data();
+        getMeshData();
+        componentCount = static_cast<int>(components.size());
+        ComputeCongruencies();
+
+        if (!cacheFilePath.empty())
+        {
+            const int numFaces = static_cast<int>(mesh->n_faces());
+            vector<unsigned int> faceComponentIDs(numFaces);
+            for (int i = 0; i < numFaces; ++i)
+            {
+                faceComponentIDs[i] = mesh->property(meshFPropComponentID, TriMesh::FaceHandle(i));
+            }
+            PrecomputeCache::Data cacheData;
+            cacheData.faceCount = numFaces;
+            cacheData.faceComponentIDs = faceComponentIDs.data();
+            cacheData.componentCount = componentCount;
+            cacheData.congruencies = &congruencies;
+            cacheData.sharpEdgeCount = numSharpEdges;
+            cacheData.sharpEdges = sharpEdges;
+            cacheData.sharpEdgeCosines = sharpEdgeCosines;
+            cacheData.surfaceFaceVertices = surfaceFaceVertices;
+            if (!PrecomputeCache::Save(cacheFilePath, meshHash, this->param.congruentThreshold, cacheData) && this->param.verbose)
+            {
+                cout << "Cannot write the precompute cache " << cacheFilePath << endl;
+            }
+        }
+    }
+
+    // upload the mesh and sharp edges now if a context is available,
+    // otherwise the first Render() will do it.
+    modelBuffersDirty = true;
+    if (this->param.rasterizer == Rasterizer::OPENGL && AcquireGL())
+    {
+        InitializeGLResources();
+        UploadModelBuffers();
+        ReleaseGL();
+    }
+
     if (this->param.verbose)
     {
         timer.Update();
@@ -197,84 +371,168 @@ bool BWAbstraction::LoadModel(string modelFilePath, bwabstraction::Parameters pa
     return true;
 }
 
-void BWAbstraction::ComputeSharpEdges()
+bool BWAbstraction::SaveBinaryModel(string filePath, bool withPrecompute)
 {
-    // use sharp edges as feature lines.
-    const float angleThreshold = 80.0f;
-    sharpEdges.clear();
-    for(TriMesh::EdgeIter eit = mesh->edges_begin(); eit != mesh->edges_end(); eit++)
+    if (mesh->n_faces() == 0)
     {
-        TriMesh::FaceHandle f1 = mesh->face_handle(mesh->halfedge_handle(*eit, 0));
-        TriMesh::FaceHandle f2 = mesh->face_handle(mesh->halfedge_handle(*eit, 1));
-        if(!f1.is_valid() || !f2.is_valid())
-        {
-            continue;
-        }
-        TriMesh::Normal n1 = mesh->normal(f1).normalized();
-        TriMesh::Normal n2 = mesh->normal(f2).normalized();
-        if(dot(n1, n2) <= cos(angleThreshold / 180.0 * M_PI))
+        return false;
+    }
+    vector<unsigned int> componentIDs;
+    if (withPrecompute)
+    {
+        componentIDs.resize(mesh->n_faces());
+        for (size_t i = 0; i < componentIDs.size(); ++i)
         {
-            TriMesh::HalfedgeHandle he = mesh->halfedge_handle(*eit, 0);
-            TriMesh::VertexHandle v1 = mesh->from_vertex_handle(he);
-            TriMesh::VertexHandle v2 = mesh->to_vertex_handle(he);
-            TriMesh::Point p1 = mesh->point(v1);
-            TriMesh::Point p2 = mesh->point(v2);
-            sharpEdges.push_back((float)p1[0]);
-            sharpEdges.push_back((float)p1[1]);
-            sharpEdges.push_back((float)p1[2]);
-            sharpEdges.push_back((float)p2[0]);
-            sharpEdges.push_back((float)p2[1]);
-            sharpEdges.push_back((float)p2[2]);
+            componentIDs[i] = mesh->property(meshFPropComponentID, TriMesh::FaceHandle(static_cast<int>(i)));
         }
     }
+    return BinaryMesh::Write(filePath, mesh, componentIDs, componentCount, withPrecompute ? sharpEdges : NULL, withPrecompute ? sharpEdgeCosines : NULL, numSharpEdges);
+}
+
+/**
+ * @brief BWAbstraction::ComputeSharpEdges
+ * Classify every interior edge by its dihedral angle once, so that Render() can pick the sharp
+ * edges of any param.sharpEdgeAngle as a prefix of sharpEdges, see SharpEdgeCount().
+ */
+void BWAbstraction::ComputeSharpEdges()
+{
+    // use sharp edges as feature lines.
+    const int numFaces = static_cast<int>(mesh->n_faces());
+    const int numEdges = static_cast<int>(mesh->n_edges());
+    sharpEdgeStorage.clear();
+    sharpEdgeCosineStorage.clear();
+    if(numFaces == 0)
+    {
+        return;
+    }
+
+    // unit face normals and the two faces of each edge as flat arrays, -1 on the boundary
+    vector<double> normalX(numFaces), normalY(numFaces), normalZ(numFaces);
+    #pragma omp parallel for
+    for(int f = 0; f < numFaces; ++f)
+    {
+        TriMesh::Normal n = mesh->normal(TriMesh::FaceHandle(f)).normalized();
+        normalX[f] = n[0];
+        normalY[f] = n[1];
+        normalZ[f] = n[2];
+    }
+    vector<int> edgeFace1(numEdges), edgeFace2(numEdges);
+    #pragma omp parallel for
+    for(int e = 0; e < numEdges; ++e)
+    {
+        TriMesh::EdgeHandle eh(e);
+        edgeFace1[e] = mesh->face_handle(mesh->halfedge_handle(eh, 0)).idx();
+        edgeFace2[e] = mesh->face_handle(mesh->halfedge_handle(eh, 1)).idx();
+    }
+
+    // branch-free, so that the compiler can vectorize it. boundary edges read face 0 and get
+    // a cosine of 2, which sorts them behind every interior edge.
+    vector<double> cosines(numEdges);
+    #pragma omp parallel for
+    for(int e = 0; e < numEdges; ++e)
+    {
+        int f1 = edgeFace1[e];
+        int f2 = edgeFace2[e];
+        int valid = (f1 >= 0) & (f2 >= 0);
+        f1 &= -valid;
+        f2 &= -valid;
+        double d = normalX[f1] * normalX[f2] + normalY[f1] * normalY[f2] + normalZ[f1] * normalZ[f2];
+        cosines[e] = valid ? d : 2.0;
+    }
+
+    // ties are broken by the edge index, so the order does not depend on the sort
+    vector<int> order(numEdges);
+    for(int e = 0; e < numEdges; ++e)
+    {
+        order[e] = e;
+    }
+    sort(order.begin(), order.end(), [&cosines](int a, int b)
+    {
+        return cosines[a] < cosines[b] || (cosines[a] == cosines[b] && a < b);
+    });
+    int numInterior = numEdges;
+    while(numInterior > 0 && cosines[order[numInterior - 1]] > 1.5)
+    {
+        --numInterior;
+    }
+
+    sharpEdgeStorage.resize(numInterior * 6);
+    sharpEdgeCosineStorage.resize(numInterior);
+    #pragma omp parallel for
+    for(int i = 0; i < numInterior; ++i)
+    {
+        TriMesh::HalfedgeHandle he = mesh->halfedge_handle(TriMesh::EdgeHandle(order[i]), 0);
+        const TriMesh::Point &p1 = mesh->point(mesh->from_vertex_handle(he));
+        const TriMesh::Point &p2 = mesh->point(mesh->to_vertex_handle(he));
+        float* out = &sharpEdgeStorage[i * 6];
+        out[0] = (float)p1[0];
+        out[1] = (float)p1[1];
+        out[2] = (float)p1[2];
+        out[3] = (float)p2[0];
+        out[4] = (float)p2[1];
+        out[5] = (float)p2[2];
+        sharpEdgeCosineStorage[i] = (float)cosines[order[i]];
+    }
+}
+
+/**
+ * @brief BWAbstraction::SharpEdgeCount
+ * @return the number of leading edges in sharpEdges whose faces meet at angle (degrees) or more.
+ */
+int BWAbstraction::SharpEdgeCount(float angle) const
+{
+    const float cosThreshold = static_cast<float>(cos(angle / 180.0 * M_PI));
+    return static_cast<int>(upper_bound(sharpEdgeCosines, sharpEdgeCosines + numSharpEdges, cosThreshold) - sharpEdgeCosines);
 }
 
 void BWAbstraction::ComputeFeatureLines()
 {
     this->featureLines.clear();
-    RenderSharpEdgeLines();
+
+    const int width = this->patchIDMap.cols;
+    const int height = this->patchIDMap.rows;
+    const int* sharpEdgeLines = this->sharpEdgeLineMap.ptr<int>();
+    const char* depthCritLines = this->depthCritLineMap.ptr<char>();
+    const char* boundaryPixels = this->boundaryMap.ptr<char>();
+    const int* patchIDs = this->patchIDMap.ptr<int>();
+    char* features = this->featureMap.ptr<char>();
+    char* marked = markedMap.ptr<char>();
 
 #ifdef BWA_MULTITHREAD
-    queue<pair<int, int> > featureLinePixelQueues[NUM_THREADS];
+    vector<int> featureLinePixelBins[NUM_THREADS];
     #pragma omp parallel for
     for (int bin = 0; bin < NUM_THREADS; ++bin)
     {
         for (auto iter = surfacePixelBins[bin].begin(); iter != surfacePixelBins[bin].end(); ++iter)
         {
-            int row = iter->first;
-            int col = iter->second;
-            bool isSharpEdge = PIXEL(this->sharpEdgeLineMap, int, row, col) == 1;
-            bool isDepthCrit = PIXEL(this->depthCritLineMap, char, row, col) == 1;
-            bool isBoundary = PIXEL(this->boundaryMap, char, row, col) == 1;
+            int pixel = *iter;
+            bool isSharpEdge = sharpEdgeLines[pixel] == 1;
+            bool isDepthCrit = depthCritLines[pixel] == 1;
+            bool isBoundary = boundaryPixels[pixel] == 1;
             if ((isSharpEdge || isDepthCrit) && !isBoundary)
             {
-                PIXEL(this->featureMap, char, row, col) = 1;
-                featureLinePixelQueues[bin].push(pair<int, int>(row, col));
+                features[pixel] = 1;
+                featureLinePixelBins[bin].push_back(pixel);
             }
         }
     }
-    queue<pair<int, int> > featureLinePixelQueue;
+    vector<int> featureLinePixels;
     for (int bin = 0; bin < NUM_THREADS; ++bin)
     {
-        while (!featureLinePixelQueues[bin].empty())
-        {
-            featureLinePixelQueue.push(featureLinePixelQueues[bin].front());
-            featureLinePixelQueues[bin].pop();
-        }
+        featureLinePixels.insert(featureLinePixels.end(), featureLinePixelBins[bin].begin(), featureLinePixelBins[bin].end());
     }
 #else
-    queue<pair<int, int> > featureLinePixelQueue;
+    vector<int> featureLinePixels;
     for (auto iter = surfacePixels.begin(); iter != surfacePixels.end(); ++iter)
     {
-        int row = iter->first;
-        int col = iter->second;
-        bool isSharpEdge = PIXEL(this->sharpEdgeLineMap, int, row, col) == 1;
-        bool isDepthCrit = PIXEL(this->depthCritLineMap, char, row, col) == 1;
-        bool isBoundary = PIXEL(this->boundaryMap, char, row, col) == 1;
+        int pixel = *iter;
+        bool isSharpEdge = sharpEdgeLines[pixel] == 1;
+        bool isDepthCrit = depthCritLines[pixel] == 1;
+        bool isBoundary = boundaryPixels[pixel] == 1;
         if ((isSharpEdge || isDepthCrit) && !isBoundary)
         {
-            PIXEL(this->featureMap, char, row, col) = 1;
-            featureLinePixelQueue.push(pair<int, int>(row, col));
+            features[pixel] = 1;
+            featureLinePixels.push_back(pixel);
         }
     }
 #endif
@@ -291,161 +549,66 @@ void BWAbstraction::ComputeFeatureLines()
         1, 1
     };
 
-    while (!featureLinePixelQueue.empty())
+    for (auto iter = featureLinePixels.begin(); iter != featureLinePixels.end(); ++iter)
     {
-        int startRow = featureLinePixelQueue.front().first;
-        int startCol = featureLinePixelQueue.front().second;
-        featureLinePixelQueue.pop();
-
-        if (PIXEL(markedMap, char, startRow, startCol) == 1)
+        int start = *iter;
+        if (marked[start] == 1)
         {
             continue;
         }
 
-        queue<pair<int, int> > pixelQueue;
-        pixelQueue.push(pair<int, int>(startRow, startCol));
-        PIXEL(markedMap, char, startRow, startCol) = 1;
-        int patchID = PIXEL(this->patchIDMap, int, startRow, startCol);
+        // the pixel list of the line doubles as the flood fill queue
+        marked[start] = 1;
+        int patchID = patchIDs[start];
         FeatureLine newLine(patchID);
-        newLine.pixels.push_back(pair<int, int>(startRow, startCol));
-        while (!pixelQueue.empty())
+        newLine.pixels.push_back(start);
+        for (size_t head = 0; head < newLine.pixels.size(); ++head)
         {
-            int row = pixelQueue.front().first;
-            int col = pixelQueue.front().second;
-            pixelQueue.pop();
+            int row = newLine.pixels[head] / width;
+            int col = newLine.pixels[head] % width;
 
             for (int i = 0; i < 8; ++i)
             {
                 int nrow = row + neighbors[i * 2];
                 int ncol = col + neighbors[i * 2 + 1];
 
-                if (!cvCheckPointRange(nrow, ncol, this->triangleIDMap))
+                if (nrow < 0 || ncol < 0 || nrow >= height || ncol >= width)
                 {
                     continue;
                 }
 
-                if (PIXEL(markedMap, char, nrow, ncol) == 1 || PIXEL(this->featureMap, char, nrow, ncol) == -1 ||
-                    PIXEL(this->patchIDMap, int, nrow, ncol) != patchID)
+                int npixel = nrow * width + ncol;
+                if (marked[npixel] == 1 || features[npixel] == -1 || patchIDs[npixel] != patchID)
                 {
                     continue;
                 }
 
-                pixelQueue.push(pair<int, int>(nrow, ncol));
-                newLine.pixels.push_back(pair<int, int>(nrow, ncol));
-                PIXEL(markedMap, char, nrow, ncol) = 1;
+                newLine.pixels.push_back(npixel);
+                marked[npixel] = 1;
             }
         }
         this->featureLines.push_back(newLine);
     }
 }
 
-void BWAbstraction::RenderSharpEdgeLines()
+void BWAbstraction::RenderSharpEdgeLines(const float mvp[16])
 {
     sharpEdgeLineTarget->bindClear(-1);
-    // use depth map from triangleIDTarget instead of copying the texture
-    // sharpEdgeLineTarget->updateDepth(this->depthMap);
-    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, triangleIDTarget->depth_buffer, 0);
     featureLineShader->Bind();
     glUniformMatrix4fv(
         glGetUniformLocation(featureLineShader->program, "mvp"),
-        1, GL_FALSE, param.mvpMatrix);
-    StandardVertexAttribute attr = CreateVertexAttrFromLines(this->sharpEdges);
-    glEnable(GL_DEPTH_TEST);
-    featureLineShader->Draw(GL_LINES, attr);
-    glDisable(GL_DEPTH_TEST);
-    this->sharpEdgeLineMap = sharpEdgeLineTarget->readback();
-    // unbind the depth buffer
-    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, sharpEdgeLineTarget->depth_buffer, 0);
-
-    attr.Destroy();
-    /*
-    glm::mat4 mvp;
-    memcpy(glm::value_ptr(mvp), this->param.mvpMatrix, sizeof(float) * 16);
-    // for each line segment
-    for (int i = 0; i < this->sharpEdges.size(); i += 6)
-    {
-        glm::vec4 p1(sharpEdges[i + 0], sharpEdges[i + 1], sharpEdges[i + 2], 1.0f);
-        glm::vec4 p2(sharpEdges[i + 3], sharpEdges[i + 4], sharpEdges[i + 5], 1.0f);
-        p1 = mvp * p1;
-        p2 = mvp * p2;
-        p1 /= p1.w;
-        p2 /= p2.w;
-        float p1x = (p1.x * 0.5f + 0.5f) * this->param.renderWidth;
-        float p1y = (-p1.y * 0.5f + 0.5f) * this->param.renderHeight;
-        float p2x = (p2.x * 0.5f + 0.5f) * this->param.renderWidth;
-        float p2y = (-p2.y * 0.5f + 0.5f) * this->param.renderHeight;
-        float p1z = p1.z * 0.5f + 0.5f;
-        float p2z = p2.z * 0.5f + 0.5f;
-        float xdiff = p2x - p1x;
-        float ydiff = p2y - p1y;
-        float zdiff = p2z - p1z;
-        if (fabs(xdiff) > fabs(ydiff))
-        {
-            float xmin, xmax;
-            if (p1x < p2x)
-            {
-                xmin = p1x;
-                xmax = p2x;
-            }
-            else
-            {
-                xmin = p2x;
-                xmax = p1x;
-            }
-            float yslope = ydiff / xdiff;
-            float zslope = zdiff / xdiff;
-            for (float x = xmin; x < xmax; x += 1.0f)
-            {
-                float y = p1y + yslope * (x - p1x);
-                float z = p1z + zslope * (x - p1x);
-                int ix = static_cast<int>(floor(x));
-                int iy = static_cast<int>(floor(y));
-                if (ix >= 0 && ix < this->param.renderWidth && iy >= 0 && iy < this->param.renderHeight)
-                {
-                    if (z <= PIXEL(this->depthMap, float, iy, ix))
-                    {
-                        PIXEL(this->sharpEdgeLineMap, int, iy, ix) = 1;
-                    }
-                }
-            }
-        }
-        else
-        {
-            float ymin, ymax;
-            if (p1y < p2y)
-            {
-                ymin = p1y;
-                ymax = p2y;
-            }
-            else
-            {
-                ymin = p2y;
-                ymax = p1y;
-            }
-            float xslope = xdiff / ydiff;
-            float zslope = zdiff / ydiff;
-            for (float y = ymin; y < ymax; y += 1.0f)
-            {
-                float x = p1x + xslope * (y - p1y);
-                float z = p1z + zslope * (y - p1y);
-                int ix = static_cast<int>(floor(x));
-                int iy = static_cast<int>(floor(y));
-                if (ix >= 0 && ix < this->param.renderWidth && iy >= 0 && iy < this->param.renderHeight)
-                {
-                    if (z <= PIXEL(this->depthMap, float, iy, ix))
-                    {
-                        PIXEL(this->sharpEdgeLineMap, int, iy, ix) = 1;
-                    }
-                }
-            }
-        }
-    }
-    */
+        1, GL_FALSE, mvp);
+    // the shader tests against the offset depth of RenderPatches() itself
+    glUniform1i(glGetUniformLocation(featureLineShader->program, "offsetDepthMap"), 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, triangleIDTarget->offset_depth_buffer);
+    featureLineShader->Draw(GL_LINES, *sharpEdgeAttribute, 0, sharpEdgeCount * 2);
 }
 
 void BWAbstraction::ComputePatches()
 {
     patches.clear();
+    patchPixels.clear();
     surfacePixels.reserve(this->param.renderWidth * this->param.renderHeight);
     surfacePixels.clear();
     surfaceBoundaryPixels.clear();
@@ -458,102 +621,87 @@ void BWAbstraction::ComputePatches()
 #endif
     strandedPixels.clear();
 
-    RenderPatches();
     ListSurfacePixels();
-    TriangleSurfaceConnectFloodfill();
+    TriangleSurfaceConnectLabeling();
     ComponentFloodfill();
     GreedyMergePixel();
     GreedyMergePatch();
 }
 
-void BWAbstraction::TriangleSurfaceConnectFloodfill()
+/**
+ * @brief BWAbstraction::TriangleSurfaceConnectLabeling
+ * Label the 4-connected pixels whose faces are connected on the surface as patches (see
+ * SurfaceLabeling). The root of a patch is its first pixel in scan order, so the patches, their
+ * IDs and the stranded pixels come out in the same order as with a sequential flood fill seeded
+ * in scan order. The pixels of a patch are stored in scan order.
+ */
+void BWAbstraction::TriangleSurfaceConnectLabeling()
 {
-    static const int neighbors[] =
-    {
-        -1, 0,
-        1, 0,
-        0, -1,
-        0, 1
-    };
+    const int width = triangleIDMap.cols;
+    const int height = triangleIDMap.rows;
+    const int pixelCount = width * height;
+    const int* triangleIDs = triangleIDMap.ptr<int>();
+    int* patchIDs = patchIDMap.ptr<int>();
+    char* depthCritLines = depthCritLineMap.ptr<char>();
+
+    rootLabels.assign(pixelCount, 0);
+    surfaceLabeling->Label(triangleIDs, width, height, surfaceFaceVertices, pixelRoots, depthCritLines);
 
-    queue<cv::Point> neighborQueue;
+    // patch sizes, then the patches in the order of their roots
     for(auto iter = surfacePixels.begin(); iter != surfacePixels.end(); ++iter)
     {
-        int row = iter->first;
-        int col = iter->second;
-        if(PIXEL(patchIDMap, int, row, col) != -1)
+        ++rootLabels[pixelRoots[*iter]];
+    }
+    int pixelBegin = 0;
+    for(auto iter = surfacePixels.begin(); iter != surfacePixels.end(); ++iter)
+    {
+        int root = *iter;
+        if(pixelRoots[root] != root)
         {
             continue;
         }
 
-        // add new patch
-        int patchID = static_cast<int>(patches.size());
-        neighborQueue.push(cv::Point(row, col));
-        PIXEL(patchIDMap, int, row, col) = patchID;
-        Patch newPatch;
-        int fid = PIXEL(triangleIDMap, int, row, col);
-        newPatch.componentID = mesh->property(meshFPropComponentID, TriMesh::FaceHandle(fid)) - 1; // 1-based index in property
-        while(!neighborQueue.empty())
+        int size = rootLabels[root];
+        if(size >= param.patchSizeThreshold)
         {
-            cv::Point p = neighborQueue.front();
-            neighborQueue.pop();
-            newPatch.pixels.push_back(pair<int, int>(p.x, p.y));
-            int id = PIXEL(triangleIDMap, int, p.x, p.y);
-            for(int n = 0; n < 4; ++n)
-            {
-                int nrow = p.x + neighbors[2 * n];
-                int ncol = p.y + neighbors[2 * n + 1];
-
-                // is (nrow, ncol) out of range or being a background?
-                if(!cvCheckPointRange(nrow, ncol, triangleIDMap) || PIXEL(triangleIDMap, int, nrow, ncol) == -1)
-                {
-                    continue;
-                }
-
-                // is (nrow, ncol) labelled?
-                if(PIXEL(patchIDMap, int, nrow, ncol) != -1)
-                {
-                    continue;
-                }
-                int id2 = PIXEL(triangleIDMap, int, nrow, ncol);
-                int start = surfaceOffset[id];
-                int end = surfaceOffset[id + 1];
-                bool found = false;
-                for(int k = start; k < end; ++k)
-                {
-                    if(surfaceConnect[k] == id2)
-                    {
-                        found = true;
-                        break;
-                    }
-                }
-                if(found)
-                {
-                    neighborQueue.push(cv::Point(nrow, ncol));
-                    PIXEL(this->patchIDMap, int, nrow, ncol) = patchID;
-                }
-                else
-                {
-                    PIXEL(this->depthCritLineMap, char, p.x, p.y) = 1;
-                }
-            }
+            Patch newPatch;
+            newPatch.pixelBegin = pixelBegin;
+            newPatch.pixelCount = size;
+            newPatch.componentID = mesh->property(meshFPropComponentID, TriMesh::FaceHandle(triangleIDs[root])) - 1; // 1-based index in property
+            rootLabels[root] = static_cast<int>(patches.size());
+            patches.push_back(newPatch);
+            pixelBegin += size;
         }
+        else
+        {
+            // this patch is too small. add its first pixel to strandedPixels. (label = -2)
+            strandedPixels.push_back(root);
+            rootLabels[root] = -2;
+        }
+    }
 
-        // is this newPatch large enough?
-        if(newPatch.pixels.size() >= param.patchSizeThreshold)
+    #pragma omp parallel for
+    for(int pixel = 0; pixel < pixelCount; ++pixel)
+    {
+        if(pixelRoots[pixel] != -1)
         {
-            patches.push_back(newPatch);
+            patchIDs[pixel] = rootLabels[pixelRoots[pixel]];
         }
-        else
+    }
+
+    // group the pixels by patch
+    vector<int> cursor(patches.size());
+    for(size_t pid = 0; pid < patches.size(); ++pid)
+    {
+        cursor[pid] = patches[pid].pixelBegin;
+    }
+    patchPixels.resize(pixelBegin);
+    for(auto iter = surfacePixels.begin(); iter != surfacePixels.end(); ++iter)
+    {
+        int pid = patchIDs[*iter];
+        if(pid >= 0)
         {
-            // this patch is too small. add its pixels to strandedPixels. (label = -2)
-            strandedPixels.push_back(newPatch.pixels[0]);
-            for(auto pixel = newPatch.pixels.begin(); pixel != newPatch.pixels.end(); ++pixel)
-            {
-                int row = pixel->first;
-                int col = pixel->second;
-                PIXEL(patchIDMap, int, row, col) = -2;
-            }
+            patchPixels[cursor[pid]++] = *iter;
         }
     }
 }
@@ -568,76 +716,85 @@ void BWAbstraction::ComponentFloodfill()
         0, 1
     };
 
-    vector<pair<int, int> > newStrandedPixels;
-    queue<cv::Point> neighborQueue;
+    const int width = triangleIDMap.cols;
+    const int height = triangleIDMap.rows;
+    const int* triangleIDs = triangleIDMap.ptr<int>();
+    int* patchIDs = patchIDMap.ptr<int>();
+
+    vector<int> newStrandedPixels;
     for(auto iter = strandedPixels.begin(); iter != strandedPixels.end(); ++iter)
     {
-        int row = iter->first;
-        int col = iter->second;
-        if(patchIDMap.at<int>(row, col) != -2)
+        int seed = *iter;
+        if(patchIDs[seed] != -2)
         {
             continue;
         }
 
         // add new patch
-        neighborQueue.push(cv::Point(row, col));
         Patch newPatch;
         int patchID = static_cast<int>(patches.size());
-        patchIDMap.at<int>(row, col) = patchID;
-        int fid = triangleIDMap.at<int>(row, col);
+        newPatch.pixelBegin = static_cast<int>(patchPixels.size());
+        patchPixels.push_back(seed);
+        patchIDs[seed] = patchID;
+        int fid = triangleIDs[seed];
         newPatch.componentID = mesh->property(meshFPropComponentID, TriMesh::FaceHandle(fid)) - 1; // 1-based index in property
-        while(!neighborQueue.empty())
+        for(size_t head = newPatch.pixelBegin; head < patchPixels.size(); ++head)
         {
-            cv::Point p = neighborQueue.front();
-            neighborQueue.pop();
-            newPatch.pixels.push_back(pair<int, int>(p.x, p.y));
+            int pixel = patchPixels[head];
+            int row = pixel / width;
+            int col = pixel % width;
             for(int n = 0; n < 4; ++n)
             {
-                int nrow = p.x + neighbors[2 * n];
-                int ncol = p.y + neighbors[2 * n + 1];
+                int nrow = row + neighbors[2 * n];
+                int ncol = col + neighbors[2 * n + 1];
 
                 // is (nrow, ncol) out of range or being a background pixel?
-                if(!cvCheckPointRange(nrow, ncol, triangleIDMap) || triangleIDMap.at<int>(nrow, ncol) == -1)
+                if(nrow < 0 || ncol < 0 || nrow >= height || ncol >= width)
+                {
+                    continue;
+                }
+                int npixel = nrow * width + ncol;
+                if(triangleIDs[npixel] == -1)
                 {
                     continue;
                 }
 
                 // is (nrow, ncol) labelled?
-                if(patchIDMap.at<int>(nrow, ncol) != -2)
+                if(patchIDs[npixel] != -2)
                 {
                     continue;
                 }
-                
-                int fid = triangleIDMap.at<int>(nrow, ncol);
+
+                int fid = triangleIDs[npixel];
                 int cid2 = mesh->property(meshFPropComponentID, TriMesh::FaceHandle(fid)) - 1; // 1-based index in property
-                
+
                 // does (nrow, ncol) have the same component as (row, col)?
                 if(newPatch.componentID == cid2)
                 {
-                    neighborQueue.push(cv::Point(nrow, ncol));
-                    patchIDMap.at<int>(nrow, ncol) = patchID;
+                    patchPixels.push_back(npixel);
+                    patchIDs[npixel] = patchID;
                 }
             }
         }
+        newPatch.pixelCount = static_cast<int>(patchPixels.size()) - newPatch.pixelBegin;
 
         // is this newPatch large enough?
-        if(newPatch.pixels.size() >= param.patchSizeThreshold)
+        if(newPatch.pixelCount >= param.patchSizeThreshold)
         {
             patches.push_back(newPatch);
         }
         else
         {
             // this patch is too small. add its pixels to strandedPixels. (label = -3)
-            for(auto pixel = newPatch.pixels.begin(); pixel != newPatch.pixels.end(); ++pixel)
+            for(size_t i = newPatch.pixelBegin; i < patchPixels.size(); ++i)
             {
-                int row = pixel->first;
-                int col = pixel->second;
-                newStrandedPixels.push_back(pair<int, int>(row, col));
-                patchIDMap.at<int>(row, col) = -3;
+                newStrandedPixels.push_back(patchPixels[i]);
+                patchIDs[patchPixels[i]] = -3;
             }
+            patchPixels.resize(newPatch.pixelBegin);
         }
     }
-    strandedPixels = newStrandedPixels;
+    strandedPixels.swap(newStrandedPixels);
 }
 
 void BWAbstraction::GreedyMergePixel()
@@ -650,13 +807,22 @@ void BWAbstraction::GreedyMergePixel()
         0, 1
     };
 
+    const int width = triangleIDMap.cols;
+    const int height = triangleIDMap.rows;
+    const int* triangleIDs = triangleIDMap.ptr<int>();
+    int* patchIDs = patchIDMap.ptr<int>();
+
+    // merged pixels are appended behind the flood filled ones and regrouped at the end
+    const size_t floodfilledPixels = patchPixels.size();
+    vector<int> newStrandedPixels;
     while(!strandedPixels.empty())
     {
-        vector<pair<int, int> > newStrandedPixels;
+        newStrandedPixels.clear();
         for(auto iter = strandedPixels.begin(); iter != strandedPixels.end(); ++iter)
         {
-            int row = iter->first;
-            int col = iter->second;
+            int pixel = *iter;
+            int row = pixel / width;
+            int col = pixel % width;
 
             int largestPatchID= -1;
             int largestPatchSize = 0;
@@ -666,39 +832,66 @@ void BWAbstraction::GreedyMergePixel()
                 int nrow = row + neighbors[2 * n];
                 int ncol = col + neighbors[2 * n + 1];
 
-                if(!cvCheckPointRange(nrow, ncol, triangleIDMap) || triangleIDMap.at<int>(nrow, ncol) == -1)
+                if(nrow < 0 || ncol < 0 || nrow >= height || ncol >= width)
+                {
+                    continue;
+                }
+                int npixel = nrow * width + ncol;
+                if(triangleIDs[npixel] == -1)
                 {
                     continue;
                 }
 
-                int pid = patchIDMap.at<int>(nrow, ncol);
+                int pid = patchIDs[npixel];
                 if(pid < 0)
                 {
                     continue;
                 }
-                if(patches[pid].pixels.size() > largestPatchSize)
+                if(patches[pid].pixelCount > largestPatchSize)
                 {
-                    largestPatchSize = static_cast<int>(patches[pid].pixels.size());
+                    largestPatchSize = patches[pid].pixelCount;
                     largestPatchID = pid;
                 }
             }
 
             if(largestPatchID != -1)
             {
-                patchIDMap.at<int>(row, col) = largestPatchID;
-                patches[largestPatchID].pixels.push_back(*iter);
+                patchIDs[pixel] = largestPatchID;
+                patchPixels.push_back(pixel);
+                ++patches[largestPatchID].pixelCount;
             }
             else
             {
-                newStrandedPixels.push_back(*iter);
+                newStrandedPixels.push_back(pixel);
             }
         }
         if(strandedPixels.size() == newStrandedPixels.size())
         {
             break;
         }
-        strandedPixels = newStrandedPixels;
+        strandedPixels.swap(newStrandedPixels);
+    }
+
+    if(patchPixels.size() == floodfilledPixels)
+    {
+        return;
+    }
+
+    // stable counting sort by patch ID, every patch keeps its flood fill pixels followed by its
+    // merged pixels in merge order
+    vector<int> cursor(patches.size());
+    int begin = 0;
+    for(size_t pid = 0; pid < patches.size(); ++pid)
+    {
+        patches[pid].pixelBegin = cursor[pid] = begin;
+        begin += patches[pid].pixelCount;
     }
+    patchPixelsScratch.resize(patchPixels.size());
+    for(auto iter = patchPixels.begin(); iter != patchPixels.end(); ++iter)
+    {
+        patchPixelsScratch[cursor[patchIDs[*iter]]++] = *iter;
+    }
+    patchPixels.swap(patchPixelsScratch);
 }
 
 void BWAbstraction::GreedyMergePatch()
@@ -706,37 +899,80 @@ void BWAbstraction::GreedyMergePatch()
     // TODO
 }
 
-void BWAbstraction::RenderPatches()
+void BWAbstraction::RenderPatches(const float mvp[16])
 {
+    // single pass: triangle IDs in attachment 0 and the polygon-offset depth
+    // for RenderSharpEdgeLines() in attachment 1 (see triangleid.fs.glsl)
     triangleIDTarget->bindClear(-1);
 
     triangleIDShader->Bind();
     glUniformMatrix4fv(
         glGetUniformLocation(triangleIDShader->program, "mvp"),
-        1, GL_FALSE, param.mvpMatrix);
+        1, GL_FALSE, mvp);
+    glUniform1f(glGetUniformLocation(triangleIDShader->program, "offsetFactor"), POLYGON_OFFSET_FACTOR);
+    glUniform1f(glGetUniformLocation(triangleIDShader->program, "offsetUnits"), POLYGON_OFFSET_UNITS * DEPTH_RESOLUTION);
 
-    StandardVertexAttribute attr = CreateVertexAttrFromMesh(mesh);
     glEnable(GL_DEPTH_TEST);
-    triangleIDShader->Draw(GL_TRIANGLES, attr);
+    triangleIDShader->Draw(GL_TRIANGLES, *meshAttribute);
     glDisable(GL_DEPTH_TEST);
-    triangleIDMap = triangleIDTarget->readback();
+}
 
-    triangleIDTarget->bindClear(-1);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_POLYGON_OFFSET_FILL); // offset depth for RenderFeatureLine()
-    glPolygonOffset(5.0f, 5.0f);
-    triangleIDShader->Draw(GL_TRIANGLES, attr);
-    glDisable(GL_POLYGON_OFFSET_FILL);
-    glDisable(GL_DEPTH_TEST);
-    depthMap = triangleIDTarget->readbackDepth();
+/**
+ * @brief BWAbstraction::SubmitGeometryPasses
+ * Queue the triangle ID / offset depth pass and the sharp edge pass of a view on the GPU
+ * without waiting for them, the CPU can keep working on the previous view in the meantime.
+ * @param mvp The view to rasterize.
+ */
+void BWAbstraction::SubmitGeometryPasses(const float mvp[16])
+{
+    if (this->param.rasterizer == Rasterizer::SOFTWARE)
+    {
+        // rasterized in ResolveGeometryPasses()
+        return;
+    }
 
-    attr.Destroy();
+    RenderPatches(mvp);
+    RenderSharpEdgeLines(mvp);
+    // copy the results into pixel buffers on the GPU timeline as well
+    triangleIDTarget->beginReadback();
+    triangleIDTarget->beginReadbackOffsetDepth();
+    sharpEdgeLineTarget->beginReadback();
+    glFlush();
 }
 
-void BWAbstraction::AddPixelToBoundary(int row, int col, int pid2, float depth2)
+/**
+ * @brief BWAbstraction::ResolveGeometryPasses
+ * Fill triangleIDMap, depthMap and sharpEdgeLineMap for param.mvpMatrix, either by reading
+ * back the passes queued by SubmitGeometryPasses() or with the software rasterizer.
+ * @return false if the OpenGL readback failed.
+ */
+bool BWAbstraction::ResolveGeometryPasses()
 {
-    int pid = patchIDMap.at<int>(row, col);
-    float depth = depthMap.at<float>(row, col);
+    if (this->param.rasterizer == Rasterizer::SOFTWARE)
+    {
+        softwareRasterizer->SetViewport(param.renderWidth, param.renderHeight);
+        softwareRasterizer->SetPolygonOffset(POLYGON_OFFSET_FACTOR, POLYGON_OFFSET_UNITS);
+        softwareRasterizer->DrawTriangles(param.mvpMatrix, meshVertices, meshIndices, triangleIDMap, depthMap);
+        softwareRasterizer->DrawLines(param.mvpMatrix, sharpEdges, sharpEdgeCount, depthMap, sharpEdgeLineMap);
+        return true;
+    }
+
+    bool valid = triangleIDTarget->readback(triangleIDMap);
+    valid = triangleIDTarget->readbackOffsetDepth(depthMap) && valid;
+    valid = sharpEdgeLineTarget->readback(sharpEdgeLineMap) && valid;
+    if (!valid)
+    {
+        cout << "OpenGL readback failed. Stopping." << endl;
+        // the maps may be partly overwritten
+        viewComputed = false;
+    }
+    return valid;
+}
+
+void BWAbstraction::AddPixelToBoundary(int pixel, int pid2, float depth2)
+{
+    int pid = PIXEL_OFFSET(patchIDMap, int, pixel);
+    float depth = PIXEL_OFFSET(depthMap, float, pixel);
 
     if(pid > pid2)
     {
@@ -755,13 +991,13 @@ void BWAbstraction::AddPixelToBoundary(int row, int col, int pid2, float depth2)
 
     int bid = boundaryMapping[key];
 
-    if(key.first == patchIDMap.at<int>(row, col))
+    if(key.first == PIXEL_OFFSET(patchIDMap, int, pixel))
     {
-        boundaries[bid].pixels[0].push_back(pair<int, int>(row, col));
+        boundaries[bid].pixels[0].push_back(pixel);
     }
     else
     {
-        boundaries[bid].pixels[1].push_back(pair<int, int>(row, col));
+        boundaries[bid].pixels[1].push_back(pixel);
     }
 
     if(depth > depth2)
@@ -789,29 +1025,38 @@ void BWAbstraction::ComputeBoundaries()
         0, 1
     };
 
+    const int width = patchIDMap.cols;
+    const int height = patchIDMap.rows;
+    const int* patchIDs = patchIDMap.ptr<int>();
+    const float* depths = depthMap.ptr<float>();
+    char* boundaryPixels = this->boundaryMap.ptr<char>();
+    uchar* distFieldInput = distFieldMapInput.ptr<uchar>();
+
     vector<int> contactPids;
 
     for(int pid = 0; pid < patches.size(); ++pid)
     {
         Patch &patch = patches[pid];
-        for(auto pixel = patch.pixels.begin(); pixel != patch.pixels.end(); ++pixel)
+        const int* pixelEnd = patchPixels.data() + patch.pixelBegin + patch.pixelCount;
+        for(const int* pixel = patchPixels.data() + patch.pixelBegin; pixel != pixelEnd; ++pixel)
         {
             bool hasBackgroundContact = false;
             bool isBoundary = false;
             contactPids.clear();
-            int row = pixel->first;
-            int col = pixel->second;
+            int row = *pixel / width;
+            int col = *pixel % width;
 
             for(int n = 0; n < 4; ++n)
             {
                 int nrow = row + neighbors[2 * n];
                 int ncol = col + neighbors[2 * n + 1];
-                if(!cvCheckPointRange(nrow, ncol, patchIDMap))
+                if(nrow < 0 || ncol < 0 || nrow >= height || ncol >= width)
                 {
                     continue;
                 }
 
-                int pid2 = patchIDMap.at<int>(nrow, ncol);
+                int npixel = nrow * width + ncol;
+                int pid2 = patchIDs[npixel];
                 if(pid2 < 0)
                 {
                     isBoundary = true;
@@ -823,9 +1068,8 @@ void BWAbstraction::ComputeBoundaries()
                     if(find(contactPids.begin(), contactPids.end(), pid2) == contactPids.end())
                     {
                         contactPids.push_back(pid2);
-                        float depth2 = depthMap.at<float>(nrow, ncol);
-                        AddPixelToBoundary(row, col, pid2, depth2);
-                        this->boundaryMap.at<char>(row, col) = 1;
+                        AddPixelToBoundary(*pixel, pid2, depths[npixel]);
+                        boundaryPixels[*pixel] = 1;
                     }
                 }
             }
@@ -833,7 +1077,7 @@ void BWAbstraction::ComputeBoundaries()
             if(isBoundary)
             {
                 ++patch.boundaryLength;
-                distFieldMapInput.at<uchar>(row, col) = 0;
+                distFieldInput[*pixel] = 0;
                 patch.boundingBox.union_point(row, col);
             }
 
@@ -850,14 +1094,13 @@ void BWAbstraction::ComputeBoundaries()
     distanceTransform(distFieldMapInput, this->distTransMap, CV_DIST_L2, CV_DIST_MASK_PRECISE);
 #endif
 
+    const float* distances = this->distTransMap.ptr<float>();
     for(auto iter = surfacePixels.begin(); iter != surfacePixels.end(); ++iter)
     {
-        int row = iter->first;
-        int col = iter->second;
-        int id = patchIDMap.at<int>(row, col);
+        int id = patchIDs[*iter];
         // there are -3s in the surfacePixel area, because there are still strandedPixels (GreedyMergePixel is not implemented)
         if (id >= 0) {
-            patches[id].maxDistanceTransform = max(patches[id].maxDistanceTransform, this->distTransMap.at<float>(row, col));
+            patches[id].maxDistanceTransform = max(patches[id].maxDistanceTransform, distances[*iter]);
         }
     }
 
@@ -885,37 +1128,37 @@ void BWAbstraction::InitializeGL()
         cout << "Initializing OpenGL..." << endl;
     }
 
-    if (!glfwInit())
+    glContext = GLContext::Create(param.contextBackend, param.verbose);
+    if (!glContext || !glContext->MakeCurrent())
     {
+        delete glContext;
+        glContext = NULL;
         return;
     }
 
-    // try to create OpenGL 4.5 context
-    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glWindow = glfwCreateWindow(1, 1, "GLFW", NULL, NULL);
-    if (!glWindow)
-    {
-        // fall back to 4.1
-        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-        glWindow = glfwCreateWindow(1, 1, "GLFW", NULL, NULL);
-        if (!glWindow)
-        {
-            glfwTerminate();
+    // core profile contexts need glewExperimental to load every entry point.
+    // without a window system only the context-level initialization is valid.
+    // the GLEW entry points are process-wide, initialize them one instance at a time.
+    // OSMesa is a separate GL library, reloading the pointers from it would break the
+    // GLFW and EGL instances rendering at the same time and the other way around.
+    GLenum err;
+    {
+        std::lock_guard<std::mutex> lock(glewMutex);
+        const int library = param.contextBackend == ContextBackend::OSMESA ? 1 : 0;
+        if (glewLibrary >= 0 && glewLibrary != library)
+        {
+            cout << "ContextBackend::OSMESA can not be mixed with the other backends in one process." << endl;
+            delete glContext;
+            glContext = NULL;
             return;
         }
+        glewExperimental = GL_TRUE;
+        err = glContext->UsesWindowSystem() ? glewInit() : glewContextInit();
+        if (GLEW_OK == err)
+        {
+            glewLibrary = library;
+        }
     }
-
-    glfwMakeContextCurrent(glWindow);
-
-    GLenum err = glewInit();
     if (GLEW_OK != err)
     {
         fprintf(stdout, "Error: %s\n", glewGetErrorString(err));
@@ -923,11 +1166,114 @@ void BWAbstraction::InitializeGL()
 
     if (param.verbose)
     {
-        fprintf(stdout, "Using GLEW %s\n", glewGetString(GLEW_VERSION));
+        fprintf(stdout, "Using GLEW %s with %s context\n", glewGetString(GLEW_VERSION), GLContext::BackendName(param.contextBackend));
         glPrintContextInfo();
     }
 
-    glInitialized = true;
+    glInitialized = true;
+}
+
+/**
+ * @brief BWAbstraction::AcquireGL
+ * Create the context on first use and make it current on the calling thread.
+ * @return False if no OpenGL is available.
+ */
+bool BWAbstraction::AcquireGL()
+{
+    if (param.useHostOpenGL)
+    {
+        return true;
+    }
+    InitializeGL();
+    return glInitialized && glContext->MakeCurrent();
+}
+
+void BWAbstraction::ReleaseGL()
+{
+    if (!param.useHostOpenGL && glContext)
+    {
+        glContext->DoneCurrent();
+    }
+}
+
+void BWAbstraction::ReleaseGLResources()
+{
+    featureLineShader->Destroy();
+    triangleIDShader->Destroy();
+    delete featureLineShader;
+    delete triangleIDShader;
+    if (hairlineShader)
+    {
+        hairlineShader->Destroy();
+        delete hairlineShader;
+        glDeleteBuffers(1, &labelSSBO);
+    }
+
+    sharpEdgeLineTarget->release();
+    triangleIDTarget->release();
+    patchIDTarget->release();
+    lineMapTarget->release();
+    outputTarget->release();
+    delete sharpEdgeLineTarget;
+    delete triangleIDTarget;
+    delete patchIDTarget;
+    delete lineMapTarget;
+    delete outputTarget;
+
+    meshAttribute->Destroy();
+    sharpEdgeAttribute->Destroy();
+    delete meshAttribute;
+    delete sharpEdgeAttribute;
+
+    glResourceInitialized = false;
+}
+
+/**
+ * @brief BWAbstraction::SetNumThreads
+ * Apply Parameters::numThreads to the calling thread until RestoreNumThreads(), so that it does
+ * not leak into the OpenMP regions of the caller or into a later call with numThreads = 0.
+ */
+void BWAbstraction::SetNumThreads()
+{
+    RestoreNumThreads();
+    savedNumThreads = OverrideMaxThreads(param.numThreads);
+}
+
+void BWAbstraction::RestoreNumThreads()
+{
+    RestoreMaxThreads(savedNumThreads);
+    savedNumThreads = 0;
+}
+
+void BWAbstraction::DetectGLInfo()
+{
+    glInfo.vendor = reinterpret_cast<const char*>(glGetString(GL_VENDOR));
+    glInfo.renderer = reinterpret_cast<const char*>(glGetString(GL_RENDERER));
+    glInfo.version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+    glInfo.shadingLanguageVersion = reinterpret_cast<const char*>(glGetString(GL_SHADING_LANGUAGE_VERSION));
+    glGetIntegerv(GL_MAJOR_VERSION, &glInfo.majorVersion);
+    glGetIntegerv(GL_MINOR_VERSION, &glInfo.minorVersion);
+    glInfo.computeShader = GLEW_ARB_compute_shader && GLEW_VERSION_4_3;
+    glInfo.directStateAccess = GLEW_ARB_direct_state_access || GLEW_VERSION_4_5;
+    // bake_hairline.cs.glsl is GLSL 4.50 and RenderBWAImage() uses glNamedBufferData()
+    glInfo.hairlineBaking = glInfo.computeShader && GLEW_VERSION_4_5;
+
+    if (param.verbose)
+    {
+        cout << "Compute shader: " << (glInfo.computeShader ? "yes" : "no") << endl;
+        cout << "Direct state access: " << (glInfo.directStateAccess ? "yes" : "no") << endl;
+        cout << "Hairline baking: " << (glInfo.hairlineBaking ? "GPU" : "CPU") << endl;
+    }
+}
+
+const GLInfo& BWAbstraction::GetGLInfo() const
+{
+    return glInfo;
+}
+
+bool BWAbstraction::UseHairlineBaking() const
+{
+    return this->param.rasterizer == Rasterizer::OPENGL && glInfo.hairlineBaking;
 }
 
 void BWAbstraction::InitializeGLResources()
@@ -937,6 +1283,8 @@ void BWAbstraction::InitializeGLResources()
         return;
     }
 
+    DetectGLInfo();
+
     try
     {
         featureLineShader = new StandardShader();
@@ -959,7 +1307,7 @@ void BWAbstraction::InitializeGLResources()
             "shader/triangleid.vs.glsl",
             "shader/triangleid.fs.glsl");
 #endif
-        if (GLEW_ARB_compute_shader && GLEW_VERSION_4_3)
+        if (glInfo.hairlineBaking)
         {
             hairlineShader = new StandardShader();
 #if USE_EMBEDDED_SHADER
@@ -977,12 +1325,12 @@ void BWAbstraction::InitializeGLResources()
     }
 
     sharpEdgeLineTarget = new INT32DTarget();
-    triangleIDTarget = new INT32DTarget();
+    triangleIDTarget = new INT32R32FDTarget();
     patchIDTarget = new INT32DTarget();
     lineMapTarget = new INT32DTarget();
     outputTarget = new RGBADTarget();
 
-    if (GLEW_ARB_compute_shader && GLEW_VERSION_4_3)
+    if (glInfo.hairlineBaking)
     {
         glGenBuffers(1, &labelSSBO);
         glBindBuffer(GL_SHADER_STORAGE_BUFFER, labelSSBO);
@@ -994,7 +1342,23 @@ void BWAbstraction::InitializeGLResources()
     lineMapTarget->init();
     outputTarget->init();
 
+    meshAttribute = new StandardVertexAttribute();
+    meshAttribute->Create();
+    sharpEdgeAttribute = new StandardVertexAttribute();
+    sharpEdgeAttribute->Create();
+
     glResourceInitialized = true;
+    glResourceOnHostContext = param.useHostOpenGL;
+}
+
+void BWAbstraction::UploadModelBuffers()
+{
+    // the vertex arrays are created once in InitializeGLResources(),
+    // here we only replace their buffer contents with the current model.
+    vector<float> empty;
+    meshAttribute->BufferData(meshVertices, empty, empty, empty, meshIndices);
+    sharpEdgeAttribute->BufferData(sharpEdges, numSharpEdges * 2);
+    modelBuffersDirty = false;
 }
 
 Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
@@ -1002,16 +1366,15 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
     int radius = static_cast<int>(round(SCALE_TO_PIXEL_WIDTH(this->param.scale)));
     int radius2 = radius / 2;
 
-    if (GLEW_ARB_compute_shader && GLEW_VERSION_4_3)
+    if (UseHairlineBaking())
     {
         // draw boundary line 1px
 #ifdef BWA_MULTITHREAD
         vector<Boundary> boundaryOMP[NUM_THREADS];
-        for (auto bit = boundaries.begin(); bit != boundaries.end(); ++bit)
+        // deal round-robin by index so that the bins do not depend on earlier frames or instances
+        for (size_t i = 0; i < boundaries.size(); ++i)
         {
-            static int bin = 0;
-            boundaryOMP[bin].push_back(*bit);
-            bin = (bin + 1) % NUM_THREADS;
+            boundaryOMP[i % NUM_THREADS].push_back(boundaries[i]);
         }
 
 #pragma omp parallel for
@@ -1024,10 +1387,10 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
                     continue;
                 }
                 int pid = bit->votes[0] > bit->votes[1] ? bit->patchIDs[0] : bit->patchIDs[1];
-                vector<pair<int, int> > &pixels = bit->votes[0] > bit->votes[1] ? bit->pixels[0] : bit->pixels[1];
+                vector<int> &pixels = bit->votes[0] > bit->votes[1] ? bit->pixels[0] : bit->pixels[1];
                 for (auto it = pixels.begin(); it != pixels.end(); ++it)
                 {
-                    mixedLineMap.at<int>(it->first, it->second) = pid;
+                    PIXEL_OFFSET(mixedLineMap, int, *it) = pid;
                 }
             }
         }
@@ -1039,10 +1402,10 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
                 continue;
             }
             int pid = bit->votes[0] > bit->votes[1] ? bit->patchIDs[0] : bit->patchIDs[1];
-            vector<pair<int, int> > &pixels = bit->votes[0] > bit->votes[1] ? bit->pixels[0] : bit->pixels[1];
+            vector<int> &pixels = bit->votes[0] > bit->votes[1] ? bit->pixels[0] : bit->pixels[1];
             for (auto it = pixels.begin(); it != pixels.end(); ++it)
             {
-                mixedLineMap.at<int>(it->first, it->second) = pid;
+                PIXEL_OFFSET(mixedLineMap, int, *it) = pid;
             }
         }
 #endif
@@ -1050,11 +1413,9 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
         // draw feature line 1 px
 #ifdef BWA_MULTITHREAD
         vector<FeatureLine> featureLineOMP[NUM_THREADS];
-        for (auto bit = featureLines.begin(); bit != featureLines.end(); ++bit)
+        for (size_t i = 0; i < featureLines.size(); ++i)
         {
-            static int bin = 0;
-            featureLineOMP[bin].push_back(*bit);
-            bin = (bin + 1) % NUM_THREADS;
+            featureLineOMP[i % NUM_THREADS].push_back(featureLines[i]);
         }
 
 #pragma omp parallel for
@@ -1069,7 +1430,7 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
                 }
                 for (auto it = bit->pixels.begin(); it != bit->pixels.end(); ++it)
                 {
-                    mixedLineMap.at<int>(it->first, it->second) = -patchIDMap.at<int>(it->first, it->second) - 1;
+                    PIXEL_OFFSET(mixedLineMap, int, *it) = -PIXEL_OFFSET(patchIDMap, int, *it) - 1;
                 }
             }
         }
@@ -1083,7 +1444,7 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
             }
             for (auto it = bit->pixels.begin(); it != bit->pixels.end(); ++it)
             {
-                mixedLineMap.at<int>(it->first, it->second) = -patchIDMap.at<int>(it->first, it->second) - 1;
+                PIXEL_OFFSET(mixedLineMap, int, *it) = -PIXEL_OFFSET(patchIDMap, int, *it) - 1;
             }
         }
 #endif
@@ -1114,10 +1475,12 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
         glBindTexture(GL_TEXTURE_2D, patchIDTarget->color_id_buffer);
         glDispatchCompute(this->param.renderWidth / 8, this->param.renderHeight / 8, 1);
 
-        Mat output8uc4 = outputTarget->readback();
-        Mat output = Mat(param.renderHeight, param.renderWidth, CV_8UC1);
-        const int from_to[] = { 0,0 };
-        mixChannels(output8uc4, output, from_to, 1);
+        Mat output;
+        if (!outputTarget->readbackRed(output))
+        {
+            cout << "OpenGL readback failed." << endl;
+            return Mat();
+        }
         return output;
     }
     else
@@ -1127,11 +1490,9 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
         // draw boundary line 1px
 #ifdef BWA_MULTITHREAD
         vector<Boundary> boundaryOMP[NUM_THREADS];
-        for (auto bit = boundaries.begin(); bit != boundaries.end(); ++bit)
+        for (size_t i = 0; i < boundaries.size(); ++i)
         {
-            static int bin = 0;
-            boundaryOMP[bin].push_back(*bit);
-            bin = (bin + 1) % NUM_THREADS;
+            boundaryOMP[i % NUM_THREADS].push_back(boundaries[i]);
         }
 
 #pragma omp parallel for
@@ -1144,10 +1505,10 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
                     continue;
                 }
                 int pid = bit->votes[0] > bit->votes[1] ? bit->patchIDs[0] : bit->patchIDs[1];
-                vector<pair<int, int> > &pixels = bit->votes[0] > bit->votes[1] ? bit->pixels[0] : bit->pixels[1];
+                vector<int> &pixels = bit->votes[0] > bit->votes[1] ? bit->pixels[0] : bit->pixels[1];
                 for (auto it = pixels.begin(); it != pixels.end(); ++it)
                 {
-                    boundaryLineMap.at<int>(it->first, it->second) = pid;
+                    PIXEL_OFFSET(boundaryLineMap, int, *it) = pid;
                 }
             }
         }
@@ -1159,10 +1520,10 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
                 continue;
             }
             int pid = bit->votes[0] > bit->votes[1] ? bit->patchIDs[0] : bit->patchIDs[1];
-            vector<pair<int, int> > &pixels = bit->votes[0] > bit->votes[1] ? bit->pixels[0] : bit->pixels[1];
+            vector<int> &pixels = bit->votes[0] > bit->votes[1] ? bit->pixels[0] : bit->pixels[1];
             for (auto it = pixels.begin(); it != pixels.end(); ++it)
             {
-                boundaryLineMap.at<int>(it->first, it->second) = pid;
+                PIXEL_OFFSET(boundaryLineMap, int, *it) = pid;
             }
         }
 #endif
@@ -1170,11 +1531,9 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
         // draw feature line 1 px
 #ifdef BWA_MULTITHREAD
         vector<FeatureLine> featureLineOMP[NUM_THREADS];
-        for (auto bit = featureLines.begin(); bit != featureLines.end(); ++bit)
+        for (size_t i = 0; i < featureLines.size(); ++i)
         {
-            static int bin = 0;
-            featureLineOMP[bin].push_back(*bit);
-            bin = (bin + 1) % NUM_THREADS;
+            featureLineOMP[i % NUM_THREADS].push_back(featureLines[i]);
         }
 
 #pragma omp parallel for
@@ -1189,7 +1548,7 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
                 }
                 for (auto it = bit->pixels.begin(); it != bit->pixels.end(); ++it)
                 {
-                    featureLineMap.at<int>(it->first, it->second) = patchIDMap.at<int>(it->first, it->second);
+                    PIXEL_OFFSET(featureLineMap, int, *it) = PIXEL_OFFSET(patchIDMap, int, *it);
                 }
             }
         }
@@ -1203,7 +1562,7 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
             }
             for (auto it = bit->pixels.begin(); it != bit->pixels.end(); ++it)
             {
-                featureLineMap.at<int>(it->first, it->second) = patchIDMap.at<int>(it->first, it->second);
+                PIXEL_OFFSET(featureLineMap, int, *it) = PIXEL_OFFSET(patchIDMap, int, *it);
             }
         }
 #endif
@@ -1211,11 +1570,9 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
         // draw lines with radius (CPU)
 #ifdef BWA_MULTITHREAD
         vector<Patch> patchOMP[NUM_THREADS];
-        for (auto bit = patches.begin(); bit != patches.end(); ++bit)
+        for (size_t i = 0; i < patches.size(); ++i)
         {
-            static int bin = 0;
-            patchOMP[bin].push_back(*bit);
-            bin = (bin + 1) % NUM_THREADS;
+            patchOMP[i % NUM_THREADS].push_back(patches[i]);
         }
 
 #pragma omp parallel for
@@ -1225,12 +1582,13 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
             {
                 int color = pit->label == 1 ? 255 : 0;
                 int negColor = pit->label == 1 ? 0 : 255;
-                for (auto it = pit->pixels.begin(); it != pit->pixels.end(); ++it)
+                auto pixelBegin = patchPixels.begin() + pit->pixelBegin;
+                for (auto it = pixelBegin; it != pixelBegin + pit->pixelCount; ++it)
                 {
-                    bwaImage.at<uchar>(it->first, it->second) = color;
+                    PIXEL_OFFSET(bwaImage, uchar, *it) = color;
 
-                    int row = it->first;
-                    int col = it->second;
+                    int row = *it / param.renderWidth;
+                    int col = *it % param.renderWidth;
                     int patchID = this->patchIDMap.at<int>(row, col);
 
                     bool found = false;
@@ -1250,7 +1608,7 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
                             }
                             if (boundaryLineMap.at<int>(nrow, ncol) == patchID)
                             {
-                                bwaImage.at<uchar>(it->first, it->second) = negColor;
+                                PIXEL_OFFSET(bwaImage, uchar, *it) = negColor;
                                 goto END_BWAPIXEL;
                             }
                             if (r * r + c * c > radius2 * radius2)
@@ -1259,7 +1617,7 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
                             }
                             if (featureLineMap.at<int>(nrow, ncol) == patchID)
                             {
-                                bwaImage.at<uchar>(it->first, it->second) = negColor;
+                                PIXEL_OFFSET(bwaImage, uchar, *it) = negColor;
                                 goto END_BWAPIXEL;
                             }
                         }
@@ -1274,12 +1632,13 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
         {
             int color = pit->label == 1 ? 255 : 0;
             int negColor = pit->label == 1 ? 0 : 255;
-            for (auto it = pit->pixels.begin(); it != pit->pixels.end(); ++it)
+            auto pixelBegin = patchPixels.begin() + pit->pixelBegin;
+            for (auto it = pixelBegin; it != pixelBegin + pit->pixelCount; ++it)
             {
-                bwaImage.at<uchar>(it->first, it->second) = color;
+                PIXEL_OFFSET(bwaImage, uchar, *it) = color;
 
-                int row = it->first;
-                int col = it->second;
+                int row = *it / param.renderWidth;
+                int col = *it % param.renderWidth;
                 int patchID = this->patchIDMap.at<int>(row, col);
 
                 bool found = false;
@@ -1299,7 +1658,7 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
                         }
                         if (boundaryLineMap.at<int>(nrow, ncol) == patchID)
                         {
-                            bwaImage.at<uchar>(it->first, it->second) = negColor;
+                            PIXEL_OFFSET(bwaImage, uchar, *it) = negColor;
                             goto END_BWAPIXEL;
                         }
                         if (r * r + c * c > radius2 * radius2)
@@ -1308,7 +1667,7 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
                         }
                         if (featureLineMap.at<int>(nrow, ncol) == patchID)
                         {
-                            bwaImage.at<uchar>(it->first, it->second) = negColor;
+                            PIXEL_OFFSET(bwaImage, uchar, *it) = negColor;
                             goto END_BWAPIXEL;
                             }
                         }
@@ -1325,75 +1684,261 @@ Mat BWAbstraction::RenderBWAImage(bwabstraction::Parameters param)
 
 void BWAbstraction::Render(Result *result, bwabstraction::Parameters param)
 {
-    this->param = param;
-    this->result = result;
-    ++renderCount;
+    const bool reuseView = viewComputed && SameView(param);
+    if (!BeginRender(param))
+    {
+        return;
+    }
+    if (!reuseView)
+    {
+        SubmitGeometryPasses(this->param.mvpMatrix);
+        if (!ResolveGeometryPasses())
+        {
+            EndRender();
+            return;
+        }
+    }
+    ProcessView(result, reuseView);
+    EndRender();
+}
+
+// the parameters SameView() compares
+static void CopyViewParameters(const bwabstraction::Parameters &view, bwabstraction::Parameters &param)
+{
+    memcpy(param.mvpMatrix, view.mvpMatrix, sizeof(float) * 16);
+    param.renderWidth = view.renderWidth;
+    param.renderHeight = view.renderHeight;
+    param.rasterizer = view.rasterizer;
+    param.patchSizeThreshold = view.patchSizeThreshold;
+    param.sharpEdgeAngle = view.sharpEdgeAngle;
+}
+
+bool BWAbstraction::Reoptimize(Result *result, bwabstraction::Parameters param)
+{
+    if (!viewComputed)
+    {
+        return false;
+    }
+    CopyViewParameters(viewParameters, param);
+    Render(result, param);
+    return true;
+}
+
+/**
+ * @brief BWAbstraction::RenderVariants
+ * Render one view with several parameter sets. The patches, boundaries and feature lines are
+ * computed once (or reused from the previous render of the same view), the optimizations of
+ * the variants run in parallel, one per thread, and the results are composited one after
+ * another since they share the render targets and line maps.
+ * @param variants The parameter sets, the view is the one of variants[0] and the view parameters
+ * of the others are ignored. incrementalOptimization is ignored, the variants start from zero.
+ * @param results One result per variant.
+ */
+void BWAbstraction::RenderVariants(const vector<Parameters> &variants, vector<Result> &results)
+{
+    results.resize(variants.size());
+    if (variants.empty())
+    {
+        return;
+    }
+    const bool reuseView = viewComputed && SameView(variants[0]);
+    if (!BeginRender(variants[0]))
+    {
+        return;
+    }
+    if (!reuseView)
+    {
+        SubmitGeometryPasses(this->param.mvpMatrix);
+        if (!ResolveGeometryPasses())
+        {
+            EndRender();
+            return;
+        }
+        ComputeView();
+    }
+
+    const int numVariants = static_cast<int>(variants.size());
+    vector<Parameters> variantParameters(variants);
+    for (int i = 0; i < numVariants; ++i)
+    {
+        CopyViewParameters(variants[0], variantParameters[i]);
+        // the warm start of one solver would depend on the order of the variants
+        variantParameters[i].incrementalOptimization = false;
+    }
 
     ::Timer timer;
     if (this->param.verbose)
     {
         timer.Start();
     }
+    // the view is only read here, each variant builds its own model
+    vector<BinaryBeliefPropagation> solvers(numVariants);
+    vector<vector<int> > labels(numVariants);
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < numVariants; ++i)
+    {
+        BeliefPropagationOptimization(variantParameters[i], &solvers[i], labels[i]);
+    }
+    if (this->param.verbose)
+    {
+        timer.Update();
+        cout << "Variants: " << numVariants << endl;
+        cout << "Optimization time: " << timer.DeltaTime() << " seconds" << endl;
+    }
 
-    InitializeGL();
-    if (!glInitialized && !param.useHostOpenGL)
+    for (int i = 0; i < numVariants; ++i)
+    {
+        this->param = variantParameters[i];
+        this->result = &results[i];
+        ++renderCount;
+        nodeLabel.swap(labels[i]);
+        ApplyLabels();
+        ResetLineMaps();
+        results[i].bwaImage = RenderBWAImage(this->param);
+        WriteResultImages(&results[i]);
+    }
+    EndRender();
+}
+
+/**
+ * @brief BWAbstraction::SameView
+ * @return true if param renders the same patches, boundaries and feature lines as the last view.
+ */
+bool BWAbstraction::SameView(const Parameters &param) const
+{
+    return memcmp(param.mvpMatrix, viewParameters.mvpMatrix, sizeof(float) * 16) == 0 &&
+        param.renderWidth == viewParameters.renderWidth &&
+        param.renderHeight == viewParameters.renderHeight &&
+        param.rasterizer == viewParameters.rasterizer &&
+        param.patchSizeThreshold == viewParameters.patchSizeThreshold &&
+        param.sharpEdgeAngle == viewParameters.sharpEdgeAngle;
+}
+
+/**
+ * @brief BWAbstraction::RenderViews
+ * Render the loaded model from several cameras with the same parameters. The GL resources and
+ * scratch maps are set up once, and the GPU rasterizes view i + 1 while the CPU extracts
+ * patches and optimizes view i. The software rasterizer renders the views one after another.
+ * @param cameras The views, param.mvpMatrix is ignored.
+ * @param results One result per camera.
+ * @param param Parameters shared by all views.
+ */
+void BWAbstraction::RenderViews(const vector<Camera> &cameras, vector<Result> &results, bwabstraction::Parameters param)
+{
+    results.resize(cameras.size());
+    if (cameras.empty() || !BeginRender(param))
     {
-        cout << "OpenGL initialization failed. Stopping." << endl;
         return;
     }
-    InitializeGLResources();
 
-    if (this->param.renderWidth != this->triangleIDMap.cols || this->param.renderHeight != this->triangleIDMap.rows)
+    SubmitGeometryPasses(cameras[0].mvpMatrix);
+    for (size_t i = 0; i < cameras.size(); ++i)
     {
-        this->featureMap = Mat(param.renderHeight, param.renderWidth, CV_8SC1, Scalar(-1));
-        this->markedMap = Mat(param.renderHeight, param.renderWidth, CV_8SC1, Scalar(0));
-        this->patchIDMap = Mat(param.renderHeight, param.renderWidth, CV_32SC1, Scalar(-1));
-        this->depthCritLineMap = Mat(param.renderHeight, param.renderWidth, CV_8SC1, Scalar(-1));
-        this->distFieldMapInput = Mat(param.renderHeight, param.renderWidth, CV_8UC1, Scalar(255));
-        this->boundaryMap = Mat(param.renderHeight, param.renderWidth, CV_8SC1, Scalar(-1));
-        this->sharpEdgeLineMap = Mat(param.renderHeight, param.renderWidth, CV_32SC1, Scalar(-1));
-        if (GLEW_ARB_compute_shader && GLEW_VERSION_4_3)
+        memcpy(this->param.mvpMatrix, cameras[i].mvpMatrix, sizeof(float) * 16);
+        if (!ResolveGeometryPasses())
         {
-            this->mixedLineMap = Mat(param.renderHeight, param.renderWidth, CV_32SC1, Scalar(-2147483647));
+            break;
         }
-        else
+        if (i + 1 < cameras.size())
         {
-            this->boundaryLineMap = Mat(param.renderHeight, param.renderWidth, CV_32SC1, Scalar(-1));
-            this->featureLineMap = Mat(param.renderHeight, param.renderWidth, CV_32SC1, Scalar(-1));
+            SubmitGeometryPasses(cameras[i + 1].mvpMatrix);
         }
-
-        sharpEdgeLineTarget->resize(param.renderWidth, param.renderHeight);
-        triangleIDTarget->resize(param.renderWidth, param.renderHeight);
-        patchIDTarget->resize(this->param.renderWidth, this->param.renderHeight);
-        lineMapTarget->resize(this->param.renderWidth, this->param.renderHeight);
-        outputTarget->resize(this->param.renderWidth, this->param.renderHeight);
+        ProcessView(&results[i]);
     }
-    else
+    EndRender();
+}
+
+bool BWAbstraction::BeginRender(bwabstraction::Parameters param)
+{
+    this->param = param;
+    SetNumThreads();
+    // the edges are uploaded once, a different angle only draws a different prefix of them
+    sharpEdgeCount = SharpEdgeCount(this->param.sharpEdgeAngle);
+
+    if (this->param.rasterizer == Rasterizer::OPENGL)
     {
-        this->featureMap = Scalar(-1);
-        this->markedMap = Scalar(0);
-        this->patchIDMap = Scalar(-1);
-        this->depthCritLineMap = Scalar(-1);
-        this->distFieldMapInput = Scalar(255);
-        this->boundaryMap = Scalar(-1);
-        this->sharpEdgeLineMap = Scalar(-1);
-        if (GLEW_ARB_compute_shader && GLEW_VERSION_4_3)
+        if (!AcquireGL())
         {
-            this->mixedLineMap = Scalar(-2147483647);
+            cout << "OpenGL initialization failed. Stopping." << endl;
+            RestoreNumThreads();
+            return false;
         }
-        else
+        InitializeGLResources();
+        if (modelBuffersDirty)
+        {
+            UploadModelBuffers();
+        }
+        if (triangleIDTarget->w != param.renderWidth || triangleIDTarget->h != param.renderHeight)
         {
-            this->boundaryLineMap = Scalar(-1);
-            this->featureLineMap = Scalar(-1);
+            sharpEdgeLineTarget->resize(param.renderWidth, param.renderHeight);
+            triangleIDTarget->resize(param.renderWidth, param.renderHeight);
+            patchIDTarget->resize(this->param.renderWidth, this->param.renderHeight);
+            lineMapTarget->resize(this->param.renderWidth, this->param.renderHeight);
+            outputTarget->resize(this->param.renderWidth, this->param.renderHeight);
         }
     }
+    return true;
+}
 
-    ComputePatches();
-    ComputeBoundaries();
-    ComputeFeatureLines();
-    ComputeSimilaritySets();
-    ComputeInclusionPairs();
-    BeliefPropagationOptimization();
+void BWAbstraction::EndRender()
+{
+    if (this->param.rasterizer == Rasterizer::OPENGL)
+    {
+        ReleaseGL();
+    }
+    RestoreNumThreads();
+}
+
+/**
+ * @brief BWAbstraction::ResetLineMaps
+ * Clear the line maps drawn by RenderBWAImage(), sized for the current parameters.
+ */
+void BWAbstraction::ResetLineMaps()
+{
+    // create() is a no-op unless the size or the rasterizer changed since the last frame
+    if (UseHairlineBaking())
+    {
+        this->mixedLineMap.create(param.renderHeight, param.renderWidth, CV_32SC1);
+        this->mixedLineMap = Scalar(-2147483647);
+    }
+    else
+    {
+        this->boundaryLineMap.create(param.renderHeight, param.renderWidth, CV_32SC1);
+        this->boundaryLineMap = Scalar(-1);
+        this->featureLineMap.create(param.renderHeight, param.renderWidth, CV_32SC1);
+        this->featureLineMap = Scalar(-1);
+    }
+}
+
+/**
+ * @brief BWAbstraction::ProcessView
+ * Run every CPU step on the maps of ResolveGeometryPasses() and write the result images.
+ * @param reuseView Keep the patches, boundaries, feature lines, similarity sets and inclusion
+ * pairs of the previous view and only optimize and composite again.
+ */
+void BWAbstraction::ProcessView(Result *result, bool reuseView)
+{
+    const Parameters &param = this->param;
+    this->result = result;
+    ++renderCount;
+
+    ::Timer timer;
+    if (this->param.verbose)
+    {
+        timer.Start();
+    }
+
+    if (reuseView)
+    {
+        // only the line maps of RenderBWAImage() are written after the view stages
+        ResetLineMaps();
+    }
+    else
+    {
+        ComputeView();
+    }
+    BeliefPropagationOptimization(param, beliefPropagation, nodeLabel);
+    ApplyLabels();
     result->bwaImage = RenderBWAImage(param);
 
     if (this->param.verbose)
@@ -1404,12 +1949,60 @@ void BWAbstraction::Render(Result *result, bwabstraction::Parameters param)
 
         cout << "Patches: " << patches.size() << endl;
         cout << "Boundaries: " << boundaries.size() << endl;
-        cout << "Components: " << components.size() << endl;
+        cout << "Components: " << componentCount << endl;
         cout << "Similarity Sets: " << similaritySets.size() << endl;
         cout << "Inclusion Pairs: " << inclusionPairs.size() << endl;
         cout << "--" << endl;
     }
 
+    WriteResultImages(result);
+}
+
+/**
+ * @brief BWAbstraction::ComputeView
+ * Run the view stages on the maps of ResolveGeometryPasses(), everything before the optimization.
+ */
+void BWAbstraction::ComputeView()
+{
+    const Parameters &param = this->param;
+
+    // triangleIDMap, depthMap and sharpEdgeLineMap are already filled for this view
+    if (this->param.renderWidth != this->patchIDMap.cols || this->param.renderHeight != this->patchIDMap.rows)
+    {
+        this->featureMap = Mat(param.renderHeight, param.renderWidth, CV_8SC1, Scalar(-1));
+        this->markedMap = Mat(param.renderHeight, param.renderWidth, CV_8SC1, Scalar(0));
+        this->patchIDMap = Mat(param.renderHeight, param.renderWidth, CV_32SC1, Scalar(-1));
+        this->depthCritLineMap = Mat(param.renderHeight, param.renderWidth, CV_8SC1, Scalar(-1));
+        this->distFieldMapInput = Mat(param.renderHeight, param.renderWidth, CV_8UC1, Scalar(255));
+        this->boundaryMap = Mat(param.renderHeight, param.renderWidth, CV_8SC1, Scalar(-1));
+    }
+    else
+    {
+        this->featureMap = Scalar(-1);
+        this->markedMap = Scalar(0);
+        this->patchIDMap = Scalar(-1);
+        this->depthCritLineMap = Scalar(-1);
+        this->distFieldMapInput = Scalar(255);
+        this->boundaryMap = Scalar(-1);
+    }
+    ResetLineMaps();
+
+    ComputePatches();
+    ComputeBoundaries();
+    ComputeFeatureLines();
+    ComputeSimilaritySets();
+    ComputeInclusionPairs();
+    viewComputed = true;
+    viewParameters = this->param;
+}
+
+/**
+ * @brief BWAbstraction::WriteResultImages
+ * Write the images of param.resultImage other than bwaImage.
+ */
+void BWAbstraction::WriteResultImages(Result *result)
+{
+    const Parameters &param = this->param;
     Scalar backgroundColor = Scalar(
         static_cast<int>(255.0f * param.backgroundColor[0]),
         static_cast<int>(255.0f * param.backgroundColor[1]),
@@ -1424,9 +2017,10 @@ void BWAbstraction::Render(Result *result, bwabstraction::Parameters param)
             GetDistinctColor(sid, rgb);
             for (auto it = similaritySets[sid].begin(); it != similaritySets[sid].end(); ++it)
             {
-                for (auto pixel = patches[*it].pixels.begin(); pixel != patches[*it].pixels.end(); ++pixel)
+                auto pixelBegin = patchPixels.begin() + patches[*it].pixelBegin;
+                for (auto pixel = pixelBegin; pixel != pixelBegin + patches[*it].pixelCount; ++pixel)
                 {
-                    result->consistencyImage.at<Vec3b>(pixel->first, pixel->second) = Vec3b(rgb[0], rgb[1], rgb[2]);
+                    PIXEL_OFFSET(result->consistencyImage, Vec3b, *pixel) = Vec3b(rgb[0], rgb[1], rgb[2]);
                 }
             }
         }
@@ -1440,9 +2034,10 @@ void BWAbstraction::Render(Result *result, bwabstraction::Parameters param)
         {
             unsigned char rgb[3];
             GetDistinctColor(pid, rgb);
-            for (auto it = pit->pixels.begin(); it != pit->pixels.end(); ++it)
+            auto pixelBegin = patchPixels.begin() + pit->pixelBegin;
+            for (auto it = pixelBegin; it != pixelBegin + pit->pixelCount; ++it)
             {
-                result->patchImage.at<Vec3b>(it->first, it->second) = Vec3b(rgb[0], rgb[1], rgb[2]);
+                PIXEL_OFFSET(result->patchImage, Vec3b, *it) = Vec3b(rgb[0], rgb[1], rgb[2]);
             }
             ++pid;
         }
@@ -1457,10 +2052,10 @@ void BWAbstraction::Render(Result *result, bwabstraction::Parameters param)
             unsigned char rgb[3];
             int pid = bit->votes[0] > bit->votes[1] ? bit->patchIDs[0] : bit->patchIDs[1];
             GetDistinctColor(pid, rgb);
-            vector<pair<int, int> > &pixels = bit->votes[0] > bit->votes[1] ? bit->pixels[0] : bit->pixels[1];
+            vector<int> &pixels = bit->votes[0] > bit->votes[1] ? bit->pixels[0] : bit->pixels[1];
             for (auto it = pixels.begin(); it != pixels.end(); ++it)
             {
-                result->boundaryImage.at<Vec3b>(it->first, it->second) = Vec3b(rgb[0], rgb[1], rgb[2]);
+                PIXEL_OFFSET(result->boundaryImage, Vec3b, *it) = Vec3b(rgb[0], rgb[1], rgb[2]);
             }
             ++bid;
         }
@@ -1506,7 +2101,7 @@ void BWAbstraction::Render(Result *result, bwabstraction::Parameters param)
             GetDistinctColor(fid, rgb);
             for (auto it = fit->pixels.begin(); it != fit->pixels.end(); ++it)
             {
-                result->featureLineImage.at<Vec3b>(it->first, it->second) = Vec3b(rgb[0], rgb[1], rgb[2]);
+                PIXEL_OFFSET(result->featureLineImage, Vec3b, *it) = Vec3b(rgb[0], rgb[1], rgb[2]);
             }
             ++fid;
         }
@@ -1530,13 +2125,11 @@ void BWAbstraction::Render(Result *result, bwabstraction::Parameters param)
         result->componentImage = Mat(param.renderHeight, param.renderWidth, CV_8UC3, backgroundColor);
         for (auto pit = surfacePixels.begin(); pit != surfacePixels.end(); ++pit)
         {
-            int row = pit->first;
-            int col = pit->second;
-            int faceID = triangleIDMap.at<int>(row, col);
+            int faceID = PIXEL_OFFSET(triangleIDMap, int, *pit);
             int componentID = mesh->property(meshFPropComponentID, TriMesh::FaceHandle(faceID));
             unsigned char rgb[3];
             GetDistinctColor(componentID, rgb);
-            result->componentImage.at<Vec3b>(row, col) = Vec3b(rgb[0], rgb[1], rgb[2]);
+            PIXEL_OFFSET(result->componentImage, Vec3b, *pit) = Vec3b(rgb[0], rgb[1], rgb[2]);
         }
     }
 
@@ -1549,9 +2142,10 @@ void BWAbstraction::Render(Result *result, bwabstraction::Parameters param)
             unsigned char rgb[3];
             GetDistinctColor(pid, rgb);
             int gray = RGBToGray(rgb);
-            for(auto it = pit->pixels.begin(); it != pit->pixels.end(); ++it)
+            auto pixelBegin = patchPixels.begin() + pit->pixelBegin;
+            for (auto it = pixelBegin; it != pixelBegin + pit->pixelCount; ++it)
             {
-                result->inclusionImage.at<Vec3b>(it->first, it->second) = Vec3b(gray, gray, gray);
+                PIXEL_OFFSET(result->inclusionImage, Vec3b, *it) = Vec3b(gray, gray, gray);
             }
             ++pid;
         }
@@ -1561,9 +2155,10 @@ void BWAbstraction::Render(Result *result, bwabstraction::Parameters param)
             int patchB = iit->second;
             unsigned char rgb[3];
             GetDistinctColor(patchB, rgb);
-            for(auto it = patches[patchB].pixels.begin(); it != patches[patchB].pixels.end(); ++it)
+            auto pixelBegin = patchPixels.begin() + patches[patchB].pixelBegin;
+            for (auto it = pixelBegin; it != pixelBegin + patches[patchB].pixelCount; ++it)
             {
-                result->inclusionImage.at<Vec3b>(it->first, it->second) = Vec3b(rgb[0], rgb[1], rgb[2]);
+                PIXEL_OFFSET(result->inclusionImage, Vec3b, *it) = Vec3b(rgb[0], rgb[1], rgb[2]);
             }
         }
     }
@@ -1578,44 +2173,63 @@ void BWAbstraction::ListSurfacePixels()
         {
             if(*(row_ptr + col) != -1)
             {
-                surfacePixels.push_back(pair<int, int>(row, col));
+                int pixel = row * triangleIDMap.cols + col;
 #ifdef BWA_MULTITHREAD
-                static int bin = 0;
-                surfacePixelBins[bin].push_back(pair<int, int>(row, col));
-                bin = (bin + 1) % NUM_THREADS;
+                surfacePixelBins[surfacePixels.size() % NUM_THREADS].push_back(pixel);
 #endif
+                surfacePixels.push_back(pixel);
             }
         }
     }
 }
 
+/**
+ * @brief BWAbstraction::ComputeSurfaceConnect
+ * Two faces are connected on the surface if they share a vertex, i.e. one face is in the
+ * vertex one-ring of the other. Instead of listing the one-rings, keep the three vertex
+ * indices of every face so that SurfaceLabeling::SurfaceConnected() can answer with nine comparisons.
+ */
 void BWAbstraction::ComputeSurfaceConnect()
 {
-    // TODO: possible speedup by using only face-to-face adjacent faces
-    surfaceConnect.clear();
-    surfaceOffset.clear();
-    std::vector<int> faceIds;
-    for(TriMesh::FaceIter it = mesh->faces_begin(); it != mesh->faces_end(); ++it)
+    const int faceCount = static_cast<int>(mesh->n_faces());
+    surfaceFaceVertexStorage.resize(faceCount * 3);
+    #pragma omp parallel for
+    for(int fid = 0; fid < faceCount; ++fid)
     {
-        surfaceOffset.push_back(static_cast<int>(surfaceConnect.size()));
-        faceIds.clear();
-        for(TriMesh::FaceVertexIter fvit = mesh->fv_iter(*it); fvit.is_valid(); ++fvit)
+        int k = 0;
+        for(TriMesh::FaceVertexIter fvit = mesh->fv_iter(TriMesh::FaceHandle(fid)); fvit.is_valid() && k < 3; ++fvit)
         {
-            for(TriMesh::VertexFaceIter vfit = mesh->vf_iter(*fvit); vfit.is_valid(); ++vfit)
-            {
-                if (find(faceIds.begin(), faceIds.end(), vfit->idx()) == faceIds.end())
-                {
-                    faceIds.push_back(vfit->idx());
-                }
-            }
+            surfaceFaceVertexStorage[fid * 3 + k++] = fvit->idx();
         }
-        for(auto fit = faceIds.begin(); fit != faceIds.end(); ++fit)
+    }
+}
+
+/**
+ * @brief SizeCell
+ * Cell of a component in the grid over OBB extents (see ComputeCongruencies()).
+ */
+struct SizeCell
+{
+    long long c[3];
+
+    bool operator==(const SizeCell &other) const
+    {
+        return c[0] == other.c[0] && c[1] == other.c[1] && c[2] == other.c[2];
+    }
+};
+
+struct SizeCellHash
+{
+    size_t operator()(const SizeCell &cell) const
+    {
+        size_t seed = 0;
+        for(int i = 0; i < 3; ++i)
         {
-            surfaceConnect.push_back(*fit);
+            seed ^= std::hash<long long>()(cell.c[i]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
         }
+        return seed;
     }
-    surfaceOffset.push_back(static_cast<int>(surfaceConnect.size()));
-}
+};
 
 void BWAbstraction::ComputeCongruencies()
 {
@@ -1623,130 +2237,161 @@ void BWAbstraction::ComputeCongruencies()
     // the model is normalized into (-1, -1, -1) ~ (1, 1, 1).
     // allowing 0.5% difference
     const double sizeTolerance = sqrt(2 * 2 * 3) * param.congruentThreshold;
-    vector<pair<int, int> > task_list;
-    for(int m = 0; m < components.size(); ++m)
+    const int numComponents = static_cast<int>(components.size());
+    #pragma omp parallel for schedule(dynamic)
+    for(int m = 0; m < numComponents; ++m)
     {
-        components[m]->BuildOBB();
+        components[m].BuildOBB(mesh);
     }
-    // generate task list
-    // filter out those whose bounding size difference is too large
-    for(int m = 0; m < components.size(); ++m)
+
+    // bucket the components by their OBB extents in cells of sizeTolerance. components whose
+    // extents differ by at most sizeTolerance are at most one cell apart along every axis, so
+    // only the 27 neighbouring cells hold candidates. vertex/face counts and areas would be
+    // tighter keys, but congruent parts may be tessellated differently.
+    const double cellSize = sizeTolerance > 0.0 ? sizeTolerance : 1e-9;
+    vector<SizeCell> cells(numComponents);
+    unordered_map<SizeCell, vector<int>, SizeCellHash> buckets;
+    for(int m = 0; m < numComponents; ++m)
     {
-        for(int n = m + 1; n < components.size(); ++n)
+        TriMesh::Point size = components[m].obb.max - components[m].obb.min;
+        for(int i = 0; i < 3; ++i)
         {
-            TriMesh* m1 = components[m];
-            TriMesh* m2 = components[n];
-            TriMesh::Point refSize = m1->obb.max - m1->obb.min;
-            TriMesh::Point objSize = m2->obb.max - m2->obb.min;
-            if((refSize-objSize).length() > sizeTolerance)
-            {
-                continue;
-            }
-            task_list.push_back(pair<int, int>(m, n));
+            cells[m].c[i] = static_cast<long long>(floor(size[i] / cellSize));
         }
+        buckets[cells[m]].push_back(m);
     }
-#ifdef BWA_MULTITHREAD
-    // process each task in parallel with omp parallel for
-    const int n_tasks = static_cast<int>(task_list.size());
-    int n_similarities[NUM_THREADS] = { 0 };
-    bool* similarity_table = new bool[n_tasks]();
-    #pragma omp parallel for
-    for (int x = 0; x < NUM_THREADS; ++x)
+
+    // candidates of n are the earlier components whose bounding size difference is small enough
+    auto listCandidates = [&](int n, vector<int> &candidates)
     {
-        for (int y = x; y < n_tasks; y += NUM_THREADS)
+        candidates.clear();
+        TriMesh::Point objSize = components[n].obb.max - components[n].obb.min;
+        SizeCell cell;
+        for(int dz = -1; dz <= 1; ++dz)
         {
-#else
-    const int n_tasks = task_list.size();
-    int n_similarities[1] = { 0 };
-    bool* similarity_table = new bool[n_tasks]();
-    for (int x = 0; x < 1; ++x)
+            for(int dy = -1; dy <= 1; ++dy)
+            {
+                for(int dx = -1; dx <= 1; ++dx)
+                {
+                    cell.c[0] = cells[n].c[0] + dx;
+                    cell.c[1] = cells[n].c[1] + dy;
+                    cell.c[2] = cells[n].c[2] + dz;
+                    auto bucket = buckets.find(cell);
+                    if(bucket == buckets.end())
+                    {
+                        continue;
+                    }
+                    for(auto it = bucket->second.begin(); it != bucket->second.end() && *it < n; ++it)
+                    {
+                        TriMesh::Point refSize = components[*it].obb.max - components[*it].obb.min;
+                        if((refSize - objSize).length() <= sizeTolerance)
+                        {
+                            candidates.push_back(*it);
+                        }
+                    }
+                }
+            }
+        }
+        sort(candidates.begin(), candidates.end());
+    };
+
+    // buckets that are neighbours are joined into groups. no component has a candidate outside of
+    // its group, so the groups are matched independently.
+    UnionFind bucketGroups;
+    bucketGroups.Reset(numComponents);
+    for(auto bucket = buckets.begin(); bucket != buckets.end(); ++bucket)
     {
-        for (int y = x; y < n_tasks; y += 1)
+        const int first = bucket->second.front();
+        for(auto it = bucket->second.begin(); it != bucket->second.end(); ++it)
         {
-#endif
-            int m = task_list[y].first;
-            int n = task_list[y].second;
-            TriMesh* m1 = components[m];
-            TriMesh* m2 = components[n];
-
-            TriMesh::Point refOrigin = m1->obb.origin;
-            TriMesh::Point refSize = m1->obb.max - m1->obb.min;
-            TriMesh::Point refAxes[3];
-            refAxes[0] = m1->obb.maxAxis;
-            refAxes[1] = m1->obb.midAxis;
-            refAxes[2] = m1->obb.minAxis;
-
-            TriMesh::Point objOrigin = m2->obb.origin;
-            TriMesh::Point objAxes[3];
-            objAxes[0] = m2->obb.maxAxis;
-            objAxes[1] = m2->obb.midAxis;
-            objAxes[2] = m2->obb.minAxis;
-
-            double shapeTolerance = refSize.length() * 0.03;
-
-            // align w.r.t. reference obb axis
-            Matrix3d refBasisMat = Matrix3d::Zero();
-            Matrix3d objBasisMat = Matrix3d::Zero();
-            for(int i = 0; i < 3; ++i)
+            bucketGroups.UniteExclusive(first, *it);
+        }
+        SizeCell cell;
+        for(int dz = -1; dz <= 1; ++dz)
+        {
+            for(int dy = -1; dy <= 1; ++dy)
             {
-                for(int j = 0; j < 3; ++j)
+                for(int dx = -1; dx <= 1; ++dx)
                 {
-                    refBasisMat(i, j) = refAxes[j][i];
-                    objBasisMat(i, j) = objAxes[j][i];
+                    cell.c[0] = bucket->first.c[0] + dx;
+                    cell.c[1] = bucket->first.c[1] + dy;
+                    cell.c[2] = bucket->first.c[2] + dz;
+                    auto neighbour = buckets.find(cell);
+                    if(neighbour != buckets.end())
+                    {
+                        bucketGroups.UniteExclusive(first, neighbour->second.front());
+                    }
                 }
             }
-            Matrix3d R = refBasisMat * objBasisMat.inverse();
-            // translate object mesh to reference mesh so that origin matches
-            TriMesh m2copy = *m2;
-            m2copy.Translate(refOrigin - objOrigin);
-            m2copy.RotateNoNormalUpdate(refOrigin, R);
-
-            // try different orientations, compute ROOT MEAN SQUARED DISTANCE
-            for(int i = 0; i < 4; ++i)
+        }
+    }
+    vector<vector<int> > groups;
+    vector<int> groupIndex(numComponents, -1);
+    for(int m = 0; m < numComponents; ++m)
+    {
+        int root = bucketGroups.Find(m);
+        if(groupIndex[root] == -1)
+        {
+            groupIndex[root] = static_cast<int>(groups.size());
+            groups.push_back(vector<int>());
+        }
+        groups[groupIndex[root]].push_back(m);
+    }
+
+    // congruency is treated as transitive. the components of a group are walked in index order,
+    // and n is only tested against the smallest candidate of every similarity set formed among its
+    // candidates so far. it joins every set it is congruent to. the walk is serial within a group,
+    // so the sets do not depend on the thread timing. a nearest vertex grid is built the first
+    // time its component is a representative, only the thread of its group touches it.
+    UnionFind similarComponents;
+    similarComponents.Reset(numComponents);
+    vector<PointGrid> referenceGrids(numComponents);
+    vector<vector<pair<int, int> > > groupCongruencies(groups.size());
+    const int numGroups = static_cast<int>(groups.size());
+    #pragma omp parallel
+    {
+        vector<int> candidates;
+        vector<pair<int, int> > candidateSets;
+        #pragma omp for schedule(dynamic)
+        for(int g = 0; g < numGroups; ++g)
+        {
+            for(auto nit = groups[g].begin(); nit != groups[g].end(); ++nit)
             {
-                TriMesh pTrialMesh = m2copy;
-                if(i != 0)
+                const int n = *nit;
+                listCandidates(n, candidates);
+                candidateSets.clear();
+                for(auto it = candidates.begin(); it != candidates.end(); ++it)
                 {
-                    pTrialMesh.RotateNoNormalUpdate(refOrigin, refAxes[i - 1], M_PI);
+                    candidateSets.push_back(pair<int, int>(similarComponents.Find(*it), *it));
                 }
-                double RMSD = 0;
-                for(TriMesh::VertexIter vit1 = pTrialMesh.vertices_begin(); vit1 != pTrialMesh.vertices_end(); ++vit1)
+                sort(candidateSets.begin(), candidateSets.end());
+                for(size_t i = 0; i < candidateSets.size(); ++i)
                 {
-                    TriMesh::Point v = pTrialMesh.point(*vit1);
-                    double minDis2 = DBL_MAX;
-                    for(TriMesh::VertexIter vit2 = m1->vertices_begin(); vit2 != m1->vertices_end(); ++vit2)
+                    if(i > 0 && candidateSets[i].first == candidateSets[i - 1].first)
                     {
-                        TriMesh::Point refV = m1->point(*vit2);
-                        double dis = (v-refV).length();
-                        double dis2 = dis * dis;
-                        minDis2 = min(minDis2, dis2);
+                        continue;
+                    }
+                    const int reference = candidateSets[i].second;
+                    if(!referenceGrids[reference].IsBuilt())
+                    {
+                        referenceGrids[reference].Build(mesh, components[reference].vertices);
+                    }
+                    if(Congruency::IsCongruent(mesh, components[reference], referenceGrids[reference], components[n]))
+                    {
+                        groupCongruencies[g].push_back(pair<int, int>(reference, n));
+                        similarComponents.UniteExclusive(reference, n);
                     }
-                    RMSD += minDis2;
-                }
-                RMSD /= pTrialMesh.n_vertices();
-                RMSD = sqrt(RMSD);
-                if(RMSD < shapeTolerance)
-                {
-                    ++n_similarities[x];
-                    similarity_table[y] = true;
-                    break;
                 }
             }
         }
     }
 
     congruencies.clear();
-    for(int x = 0; x < n_tasks; ++x)
+    for(auto it = groupCongruencies.begin(); it != groupCongruencies.end(); ++it)
     {
-        if(similarity_table[x])
-        {
-            int m = task_list[x].first;
-            int n = task_list[x].second;
-            congruencies.push_back(pair<int, int>(m, n));
-        }
+        congruencies.insert(congruencies.end(), it->begin(), it->end());
     }
-
-    delete[] similarity_table;
+    sort(congruencies.begin(), congruencies.end());
 }
 
 void BWAbstraction::ComputeInclusionPairs()
@@ -1785,7 +2430,7 @@ void BWAbstraction::ComputeInclusionPairs()
 void BWAbstraction::ComputeSimilaritySets()
 {
     similaritySets.clear();
-    const int numComponents = static_cast<int>(components.size());
+    const int numComponents = componentCount;
     vector<vector<int> > adjacencyList;
     vector<vector<int> > patchList;
     vector<bool> visited;
@@ -1850,7 +2495,7 @@ float BWAbstraction::b_term(int c)
 
 float BWAbstraction::a_term(int q)
 {
-    return static_cast<float>(patches[q].pixels.size()) / static_cast<float>(param.renderWidth * param.renderHeight);
+    return static_cast<float>(patches[q].pixelCount) / static_cast<float>(param.renderWidth * param.renderHeight);
 }
 
 float BWAbstraction::d_term(int c)
@@ -1876,74 +2521,155 @@ float BWAbstraction::lbg_term(int q)
     return normalizedLength * a_term(q);
 }
 
-float BWAbstraction::scale_contrast_term(int c)
+float BWAbstraction::scale_contrast_term(int c, float scale)
 {
     float D1 = D_term(boundaries[c].patchIDs[0]);
     float D2 = D_term(boundaries[c].patchIDs[1]);
     float B = 2.0f * min(D1, D2);
-    return max(0.0f, 1.0f - param.scale / B);
+    return max(0.0f, 1.0f - scale / B);
 }
 
-float BWAbstraction::scale_line_term(int c)
+float BWAbstraction::scale_line_term(int c, float scale)
 {
     float D1 = D_term(boundaries[c].patchIDs[0]);
     float D2 = D_term(boundaries[c].patchIDs[1]);
     float B = 1.0f * min(D1, D2);
-    return max(0.0f, 1.0f - param.scale / B);
+    return max(0.0f, 1.0f - scale / B);
 }
 
-void BWAbstraction::BeliefPropagationOptimization()
+/**
+ * @brief BWAbstraction::BeliefPropagationOptimization
+ * Label the patches and boundaries of the current view. Only reads the view, so that several
+ * parameter sets can be optimized at once with their own solvers.
+ * @param param The weights and scale, the view parameters are those of the current view.
+ * @param solver The solver to build the model in.
+ * @param labels One label per patch, followed by one per boundary.
+ */
+void BWAbstraction::BeliefPropagationOptimization(const Parameters &param, BinaryBeliefPropagation *solver, vector<int> &labels)
 {
-    size_t numNodes = patches.size() + boundaries.size();
-    nodeLabel.clear();
-    nodeLabel.resize(numNodes);
-    size_t numLabels = 2;
-
-    typedef SimpleDiscreteSpace<int, int> Space;
-    typedef float PrecisionT;
-    typedef GraphicalModel<PrecisionT, Adder, ExplicitFunction<PrecisionT>, Space> Model;
-    typedef BeliefPropagationUpdateRules<Model, Maximizer> UpdateRules;
-    typedef MessagePassing<Model, Maximizer, UpdateRules, MaxDistance> BeliefPropogation;
-    const size_t maxIterations = 40;
-    const PrecisionT convergenceBound = static_cast<PrecisionT>(1e-20);
-    const PrecisionT damping = 0.0;
-
-    Space space(static_cast<int>(numNodes), static_cast<int>(numLabels));
-    Model model(space);
+    const int numPatches = static_cast<int>(patches.size());
+    const int numBoundaries = static_cast<int>(boundaries.size());
+    const int maxIterations = 40;
+    // the warm start only needs to settle, not to reach the exact fixed point
+    const float convergenceBound = param.incrementalOptimization ? INCREMENTAL_CONVERGENCE_BOUND : 1e-20f;
+
+    // large similarity sets get one auxiliary node each, see below
+    int numStars = 0;
+    for(auto it = similaritySets.begin(); it != similaritySets.end(); ++it)
+    {
+        numStars += it->size() > SIMILARITY_STAR_SIZE;
+    }
+    solver->Reset(numPatches + numBoundaries + numStars);
+
+    // for the incremental optimization, nodes are matched to the previous view by the smallest
+    // visible triangle ID of their patches. the top two bits tell patches, boundaries and
+    // auxiliary nodes apart.
+    const unsigned long long patchKey = 1ull << 62;
+    const unsigned long long boundaryKey = 2ull << 62;
+    const unsigned long long starKey = 3ull << 62;
+    vector<unsigned long long> nodeKeys;
+    vector<int> patchTriangles;
+    if(param.incrementalOptimization)
+    {
+        const int* triangleIDs = triangleIDMap.ptr<int>();
+        nodeKeys.resize(numPatches + numBoundaries + numStars);
+        patchTriangles.resize(numPatches);
+        #pragma omp parallel for
+        for(int i = 0; i < numPatches; ++i)
+        {
+            int triangle = INT_MAX;
+            for(int k = patches[i].pixelBegin; k < patches[i].pixelBegin + patches[i].pixelCount; ++k)
+            {
+                triangle = min(triangle, triangleIDs[patchPixels[k]]);
+            }
+            patchTriangles[i] = triangle;
+        }
+        // disjoint patches can show the same triangle, e.g. one split by an occluder. they can
+        // not be told apart from the previous view and start from zero, like their boundaries
+        // and auxiliary nodes.
+        vector<int> sortedTriangles(patchTriangles);
+        sort(sortedTriangles.begin(), sortedTriangles.end());
+        for(int i = 0; i < numPatches; ++i)
+        {
+            auto range = equal_range(sortedTriangles.begin(), sortedTriangles.end(), patchTriangles[i]);
+            if(range.second - range.first > 1)
+            {
+                patchTriangles[i] = -1;
+            }
+            nodeKeys[i] = patchTriangles[i] < 0 ? NO_VARIABLE_KEY :
+                patchKey | static_cast<unsigned long long>(patchTriangles[i]);
+        }
+        // independent of the order of the patch indices, which changes between views
+        #pragma omp parallel for
+        for(int c = 0; c < numBoundaries; ++c)
+        {
+            const int t0 = patchTriangles[boundaries[c].patchIDs[0]];
+            const int t1 = patchTriangles[boundaries[c].patchIDs[1]];
+            nodeKeys[numPatches + c] = t0 < 0 || t1 < 0 ? NO_VARIABLE_KEY : boundaryKey |
+                static_cast<unsigned long long>(min(t0, t1)) << 31 |
+                static_cast<unsigned long long>(max(t0, t1));
+        }
+    }
 
     // similarity term (SMOOTH)
+    int starNode = numPatches + numBoundaries;
+    vector<pair<float, int> > areas;
     for(auto it = similaritySets.begin(); it != similaritySets.end(); ++it)
     {
-        for(auto it2 = it->begin(); it2 != it->end(); ++it2)
+        if(it->size() <= SIMILARITY_STAR_SIZE)
         {
-            for(auto it3 = it2 + 1; it3 != it->end(); ++it3)
+            for(auto it2 = it->begin(); it2 != it->end(); ++it2)
             {
-                pair<int, int> p = *it2 >= *it3 ? pair<int, int>(*it3, *it2) : pair<int, int>(*it2, *it3);
-                const size_t shape[] = { numLabels, numLabels };
-                ExplicitFunction<PrecisionT> f(shape, shape + 2, 1.0);
-                float m_a = min(a_term(p.first), a_term(p.second)) * param.consistencyWeight;
-                f(0, 0) = 1 * m_a;
-                f(1, 0) = -1 * m_a;
-                f(0, 1) = -1 * m_a;
-                f(1, 1) = 1 * m_a;
-                Model::FunctionIdentifier fid = model.addFunction(f);
-                const int variableIndices[] = { p.first, p.second };
-                model.addFactor(fid, variableIndices, variableIndices + 2);
+                for(auto it3 = it2 + 1; it3 != it->end(); ++it3)
+                {
+                    pair<int, int> p = *it2 >= *it3 ? pair<int, int>(*it3, *it2) : pair<int, int>(*it2, *it3);
+                    float m_a = min(a_term(p.first), a_term(p.second)) * param.consistencyWeight;
+                    // f(x0, x1) at x0 + 2 * x1
+                    const float f[] = { 1 * m_a, -1 * m_a, -1 * m_a, 1 * m_a };
+                    solver->AddFactor(p.first, p.second, f);
+                }
             }
+            continue;
+        }
+
+        // instead of a factor per pair, every patch is tied to an auxiliary node with the sum of
+        // the weights of all of its pairs. the auxiliary node follows the majority, so a single
+        // patch disagreeing with the rest of the set loses exactly as much as with the pairs.
+        // a split into s and n - s patches of equal areas loses (n - 1) / (n - s) times as much,
+        // less than twice. scaling the weights down for the larger splits would undercharge the
+        // single patches, which are the common case, and matches the pairwise labels worse.
+        // with the areas in ascending order, the pairs of the k-th patch weigh the areas before
+        // it plus its own area once for every patch after it.
+        const int n = static_cast<int>(it->size());
+        areas.clear();
+        int triangle = INT_MAX;
+        for(auto it2 = it->begin(); it2 != it->end(); ++it2)
+        {
+            areas.push_back(pair<float, int>(a_term(*it2), *it2));
+            triangle = patchTriangles.empty() ? triangle : min(triangle, patchTriangles[*it2]);
         }
+        if(!nodeKeys.empty())
+        {
+            nodeKeys[starNode] = triangle < 0 ? NO_VARIABLE_KEY : starKey | static_cast<unsigned long long>(triangle);
+        }
+        sort(areas.begin(), areas.end());
+        float smallerAreas = 0.0f;
+        for(int k = 0; k < n; ++k)
+        {
+            float m_a = (smallerAreas + areas[k].first * (n - 1 - k)) * param.consistencyWeight;
+            const float f[] = { 1 * m_a, -1 * m_a, -1 * m_a, 1 * m_a };
+            solver->AddFactor(areas[k].second, starNode, f);
+            smallerAreas += areas[k].first;
+        }
+        ++starNode;
     }
 
     // background term (DATA)
     for(int i = 0; i < patches.size(); ++i)
     {
-        const size_t shape[] = { numLabels };
-        ExplicitFunction<PrecisionT> f(shape, shape + 1);
         float l = lbg_term(i) * param.backgroundWeight;
-        f(0) = 1 * l;
-        f(1) = 0 * l;
-        Model::FunctionIdentifier fid = model.addFunction(f);
-        const int variableIndices[] = { i };
-        model.addFactor(fid, variableIndices, variableIndices + 1);
+        const float f[] = { 1 * l, 0 * l };
+        solver->AddFactor(i, f);
     }
 
     // neighbor term
@@ -1958,62 +2684,36 @@ void BWAbstraction::BeliefPropagationOptimization()
         int q1 = p.first;
         int q2 = p.second;
 
-        const size_t shape[] = { numLabels, numLabels, numLabels };
-        ExplicitFunction<PrecisionT> f(shape, shape + 3, 1.0);
         float lt = l_term(c);
         float dt = d_term(c) / maxAvgDepthDiff;
         bool hasInclusionRelation =
             inclusionPairs.find(pair<int, int>(q1, q2)) != inclusionPairs.end() ||
             inclusionPairs.find(pair<int, int>(q2, q1)) != inclusionPairs.end();
         float include = hasInclusionRelation ? param.inclusionWeight : 1.0f;
+        // f(x0, x1, x2) at x0 + 2 * x1 + 4 * x2
+        float f[8];
         // merge
-        f(0, 0, 0) =
-            f(1, 1, 0) = 0.00000001f * param.neighbourWeight;
+        f[0] =
+            f[3] = 0.00000001f * param.neighbourWeight;
         // split contrast
-        f(1, 0, 0) =
-            f(0, 1, 0) = scale_contrast_term(c) * lt * (1 - dt) * include * param.neighbourWeight;
+        f[1] =
+            f[2] = scale_contrast_term(c, param.scale) * lt * (1 - dt) * include * param.neighbourWeight;
         // split line
-        f(0, 0, 1) =
-            f(1, 1, 1) = scale_line_term(c) * lt * max(0.01f, (dt + param.contrastWeight)) * param.neighbourWeight;
+        f[4] =
+            f[7] = scale_line_term(c, param.scale) * lt * max(0.01f, (dt + param.contrastWeight)) * param.neighbourWeight;
         // invalid case
-        f(1, 0, 1) =
-            f(0, 1, 1) = 0;
-        Model::FunctionIdentifier fid = model.addFunction(f);
-        const int variableIndices[] = { q1, q2, c + static_cast<int>(patches.size()) };
-        model.addFactor(fid, variableIndices, variableIndices + 3);
+        f[5] =
+            f[6] = 0;
+        solver->AddFactor(q1, q2, c + numPatches, f);
     }
 
-    /*
-    // force term (DATA)
-    for(int i = 0; i < l->segmentLabelOverride.size(); ++i)
-    {
-        int labelOverride = l->segmentLabelOverride[i];
-        if(labelOverride == -1)
-        {
-            continue;
-        }
-        const size_t shape[] = { numLabels };
-        ExplicitFunction<PrecisionT> f(shape, shape + 1);
-        if(labelOverride == 0)
-        {
-            f(0) = 10000;
-            f(1) = 0;
-        }
-        else
-        {
-            f(0) = 0;
-            f(1) = 10000;
-        }
-        Model::FunctionIdentifier fid = model.addFunction(f);
-        const int variableIndices[] = { i };
-        model.addFactor(fid, variableIndices, variableIndices + 1);
-    }
-    */
+    solver->Infer(maxIterations, convergenceBound, labels, nodeKeys.empty() ? NULL : &nodeKeys);
+    // the labels of the auxiliary nodes are not used
+    labels.resize(numPatches + numBoundaries);
+}
 
-    BeliefPropogation::Parameter parameter(maxIterations, convergenceBound, damping);
-    BeliefPropogation bp(model, parameter);
-    bp.infer();
-    bp.arg(nodeLabel);
+void BWAbstraction::ApplyLabels()
+{
     for(int i = 0; i < patches.size(); ++i)
     {
         patches[i].label = nodeLabel[i];
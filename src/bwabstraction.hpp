@@ -29,15 +29,21 @@
 #define SCALE_TO_IMAGE_WIDTH(s) (MIN_WIDTH + (MAX_WIDTH - MIN_WIDTH) * (s))
 #define SCALE_TO_PIXEL_WIDTH(s) (SCALE_SMALLEST_PX - (SCALE_SMALLEST_PX - SCALE_LARGEST_PX) * ((SCALE_TO_IMAGE_WIDTH(s) - MIN_WIDTH) / (MAX_WIDTH - MIN_WIDTH)))
 
-class GLFWwindow;
-
 typedef struct _INT32DTarget INT32DTarget;
+typedef struct _INT32R32FDTarget INT32R32FDTarget;
 typedef struct _RGBADTarget RGBADTarget;
 class StandardShader;
+class StandardVertexAttribute;
 
 namespace bwabstraction {
 
 class TriMesh;
+typedef struct _Component Component;
+class GLContext;
+class SoftwareRasterizer;
+class SurfaceLabeling;
+class BinaryBeliefPropagation;
+class PrecomputeCache;
 
 // bitfield
 enum ResultImage
@@ -55,6 +61,21 @@ enum ResultImage
     ALL = (1 << 10) - 1,
 };
 
+// backend used by InitializeGL() to create its own OpenGL context (ignored with useHostOpenGL)
+enum ContextBackend
+{
+    GLFW = 0,   // hidden GLFW window, needs a display server
+    EGL = 1,    // surfaceless EGL context, e.g. Mesa llvmpipe on headless servers
+    OSMESA = 2, // Mesa off-screen software context
+};
+
+// how the triangle ID, depth and sharp edge maps are rasterized
+enum Rasterizer
+{
+    OPENGL = 0,   // OpenGL passes, needs a context (see ContextBackend)
+    SOFTWARE = 1, // multithreaded CPU rasterizer, no OpenGL at all
+};
+
 typedef struct _Parameters
 {
 
@@ -68,8 +89,14 @@ typedef struct _Parameters
 
     float congruentThreshold;
     int patchSizeThreshold;
+    float sharpEdgeAngle; // edges whose faces meet at this dihedral angle (degrees) or more are feature lines, applied per Render()
+    bool incrementalOptimization; // start the optimization from the one of the previous Render(), for small changes of the view or weights
 
     bool useHostOpenGL;
+    int contextBackend;
+    int rasterizer;
+    int numThreads; // OpenMP threads per instance, 0 keeps the OpenMP default
+    std::string cacheDirectory; // directory of the LoadModel() precompute cache, empty disables it
     bool verbose;
     int renderWidth;
     int renderHeight;
@@ -93,8 +120,14 @@ typedef struct _Parameters
 
         congruentThreshold = 0.005f;
         patchSizeThreshold = 30;
+        sharpEdgeAngle = 80.0f;
+        incrementalOptimization = false;
 
         useHostOpenGL = false;
+        contextBackend = ContextBackend::GLFW;
+        rasterizer = Rasterizer::OPENGL;
+        numThreads = 0;
+        cacheDirectory = "";
         verbose = false;
 
         resultImage += ResultImage::BWA;
@@ -122,6 +155,36 @@ typedef struct _Result
 
 } Result;
 
+// OpenGL implementation information detected after the context is ready
+typedef struct _GLInfo
+{
+
+    std::string vendor;
+    std::string renderer;
+    std::string version;
+    std::string shadingLanguageVersion;
+    int majorVersion;
+    int minorVersion;
+    bool computeShader;     // GL 4.3 compute shaders
+    bool directStateAccess; // GL 4.5 direct state access
+    bool hairlineBaking;    // RenderBWAImage() bakes the result with the bake_hairline compute shader
+
+    _GLInfo()
+    {
+        majorVersion = minorVersion = 0;
+        computeShader = directStateAccess = hairlineBaking = false;
+    }
+
+} GLInfo;
+
+// a view for BWAbstraction::RenderViews(), same convention as Parameters::mvpMatrix
+typedef struct _Camera
+{
+
+    float mvpMatrix[16];
+
+} Camera;
+
 typedef struct BoundingBox_S
 {
 
@@ -163,7 +226,9 @@ typedef struct BoundingBox_S
 typedef struct _Patch
 {
 
-    std::vector<std::pair<int, int> > pixels;
+    // the pixels of a patch are patchPixels[pixelBegin, pixelBegin + pixelCount) of BWAbstraction
+    int pixelBegin;
+    int pixelCount;
     BoundingBox boundingBox;
     int componentID;
     int label;
@@ -176,6 +241,7 @@ typedef struct _Patch
     _Patch()
     {
         componentID = label = labelOverride = -1;
+        pixelBegin = pixelCount = 0;
         boundaryLength = backgroundBoundaryLength = 0;
         maxDistanceTransform = 0.0f;
     }
@@ -186,7 +252,8 @@ typedef struct _Boundary
 {
     int patchIDs[2];
     int votes[2];
-    std::vector<std::pair<int, int> > pixels[2];
+    // linear pixel offsets (row * width + col)
+    std::vector<int> pixels[2];
     float avgDepthDiff;
     int label;
     int labelOverride;
@@ -205,7 +272,8 @@ typedef struct _Boundary
 typedef struct _FeatureLine
 {
     int patchID;
-    std::vector<std::pair<int, int> > pixels;
+    // linear pixel offsets (row * width + col)
+    std::vector<int> pixels;
 
     _FeatureLine(int pid)
     {
@@ -213,27 +281,76 @@ typedef struct _FeatureLine
     }
 } FeatureLine;
 
+/**
+ * @brief The BWAbstraction class
+ * Thread safety: the only state instances share are GLEW's OpenGL entry points, which are
+ * process-wide. Apart from that, independent instances can run LoadModel() and Render()
+ * concurrently on different threads. A single instance must only be used by one thread at a
+ * time. Each instance owns its OpenGL context, which is made current on entry of LoadModel()
+ * and Render() and released before they return, so an instance can also move between threads
+ * between calls.
+ * GLFW only allows creating windows on the main thread, use ContextBackend::EGL,
+ * ContextBackend::OSMESA or Rasterizer::SOFTWARE on worker threads. Since the entry points are
+ * shared, ContextBackend::OSMESA can not be mixed with the other backends in one process, the
+ * first context decides and later ones of the other kind fail. With useHostOpenGL the
+ * caller keeps its context current instead, also while destroying the instance, which deletes
+ * its OpenGL objects on the current context. Set Parameters::numThreads to split the cores
+ * between instances, it applies to the OpenMP parallel regions started by the calling thread
+ * while LoadModel() or a render runs, and the thread count of the caller is restored after.
+ */
 class BWAbstraction
 {
 
 public:
 
     BWAbstraction();
+    ~BWAbstraction();
+    BWAbstraction(const BWAbstraction&) = delete;
+    BWAbstraction& operator=(const BWAbstraction&) = delete;
+    // modelFilePath is a Wavefront OBJ file or a .bwm file written by SaveBinaryModel()
     bool LoadModel(std::string modelFilePath, bwabstraction::Parameters param);
+    // write the loaded model as a .bwm file, with the component IDs and sharp edges if withPrecompute
+    bool SaveBinaryModel(std::string filePath, bool withPrecompute = true);
+    // reuses the patches, boundaries and feature lines of the previous Render() if only the
+    // optimization weights, scale, featureWeight, backgroundColor or resultImage changed
     void Render(Result *result, Parameters param);
+    // optimize and composite the view of the previous Render() again with new weights, the view
+    // parameters of param are ignored. false if nothing was rendered since LoadModel().
+    bool Reoptimize(Result *result, Parameters param);
+    // render one view with several parameter sets, the view is computed once and the
+    // optimizations run in parallel. the view parameters of variants[0] are used for all.
+    void RenderVariants(const std::vector<Parameters> &variants, std::vector<Result> &results);
+    // render many views of the same model, overlapping GPU and CPU work
+    void RenderViews(const std::vector<Camera> &cameras, std::vector<Result> &results, Parameters param);
+    // valid after the first successful LoadModel() or Render()
+    const GLInfo& GetGLInfo(void) const;
 
 private:
     // steps done in LoadModel (only need to be run once for each model)
     void ComputeCongruencies(void);
     void ComputeSharpEdges(void);
     void ComputeSurfaceConnect(void);
+    int SharpEdgeCount(float angle) const;
     
+    // rasterization of a view, done before the CPU steps
+    bool BeginRender(Parameters param);
+    bool SameView(const Parameters &param) const;
+    void EndRender(void);
+    void SubmitGeometryPasses(const float mvp[16]);
+    bool ResolveGeometryPasses(void);
+    void RenderPatches(const float mvp[16]);
+    void RenderSharpEdgeLines(const float mvp[16]);
+    // CPU steps of a view
+    void ProcessView(Result *result, bool reuseView = false);
+    void ComputeView(void);
+    void WriteResultImages(Result *result);
+    void ResetLineMaps(void);
+
     // 1st step
     void ComputePatches(void);
     // steps of ComputePatches
-    void RenderPatches(void);
     void ListSurfacePixels(void);
-    void TriangleSurfaceConnectFloodfill(void); // includes depth critical
+    void TriangleSurfaceConnectLabeling(void); // includes depth critical
     void ComponentFloodfill(void);
     void GreedyMergePixel(void);
     void GreedyMergePatch(void);
@@ -243,8 +360,6 @@ private:
 
     // 3rd step
     void ComputeFeatureLines(void);
-    // step of ComputeFeatureLines
-    void RenderSharpEdgeLines(void);
 
     // 4th step
     void ComputeSimilaritySets(void);
@@ -253,7 +368,8 @@ private:
     void ComputeInclusionPairs(void);
 
     // 6th step
-    void BeliefPropagationOptimization(void);
+    void BeliefPropagationOptimization(const Parameters &param, BinaryBeliefPropagation *solver, std::vector<int> &labels);
+    void ApplyLabels(void);
     // terms used in optimization
     float b_term(int c);
     float a_term(int q);
@@ -261,34 +377,61 @@ private:
     float D_term(int q);
     float l_term(int c);
     float lbg_term(int q);
-    float scale_contrast_term(int c);
-    float scale_line_term(int c);
+    float scale_contrast_term(int c, float scale);
+    float scale_line_term(int c, float scale);
 
     // final step
     cv::Mat RenderBWAImage(bwabstraction::Parameters param);
 
     // other utility functions
     void InitializeGL(void);
+    bool AcquireGL(void);
+    void ReleaseGL(void);
+    void ReleaseGLResources(void);
+    void SetNumThreads(void);
+    void RestoreNumThreads(void);
+    void DetectGLInfo(void);
     void InitializeGLResources(void);
-    void AddPixelToBoundary(int row, int col, int pid2, float depth2);
+    void UploadModelBuffers(void);
+    bool UseHairlineBaking(void) const;
+    void AddPixelToBoundary(int pixel, int pid2, float depth2);
 
-    GLFWwindow* glWindow;
+    GLContext* glContext;
+    GLInfo glInfo;
     bool glInitialized;
     bool glResourceInitialized;
+    // the resources were created on the context of the caller (useHostOpenGL)
+    bool glResourceOnHostContext;
     TriMesh* mesh;
     OpenMesh::FPropHandleT<unsigned int> meshFPropComponentID;
     Parameters param;
     Result* result;
-    std::vector<TriMesh*> components;
+    std::vector<Component> components; // empty if the precompute came from the cache
+    int componentCount;
     std::vector<std::pair<int, int> > congruencies;
-    std::vector<float> sharpEdges;
-    std::vector<int> surfaceOffset;
-    std::vector<int> surfaceConnect;
+    // the mapped cache file of the model, sharpEdges, sharpEdgeCosines and surfaceFaceVertices
+    // point into it on a cache hit and into the ...Storage vectors below otherwise
+    PrecomputeCache* precomputeCache;
+    // two endpoints (xyz) per interior edge, sorted by sharpEdgeCosines
+    const float* sharpEdges;
+    // cosine of the dihedral angle of each edge in sharpEdges, ascending, so the sharpest edges come first
+    const float* sharpEdgeCosines;
+    int numSharpEdges;
+    int sharpEdgeCount; // the prefix of sharpEdges drawn for param.sharpEdgeAngle
+    // three vertex indices per face, see ComputeSurfaceConnect()
+    const int* surfaceFaceVertices;
+    std::vector<float> sharpEdgeStorage;
+    std::vector<float> sharpEdgeCosineStorage;
+    std::vector<int> surfaceFaceVertexStorage;
     std::vector<Patch> patches;
     std::vector<Boundary> boundaries;
     std::vector<FeatureLine> featureLines;
     std::vector<int> nodeLabel;
+    BinaryBeliefPropagation* beliefPropagation;
     int renderCount = 0;
+    // the patches and boundaries of the last view, computed with viewParameters
+    bool viewComputed = false;
+    Parameters viewParameters;
 
     template<typename T1, typename T2>
     struct pair_hash
@@ -307,12 +450,20 @@ private:
     // map (segA, segB)->boundary ID
     std::unordered_map<std::pair<int, int>, int, pair_hash<int, int> > boundaryMapping;
 
-    std::vector<std::pair<int, int> > surfacePixels;
-    std::vector<std::pair<int, int> > surfaceBoundaryPixels;
+    // all pixel lists below hold linear offsets (row * width + col) into the maps
+    std::vector<int> surfacePixels;
+    std::vector<int> surfaceBoundaryPixels;
 #ifdef BWA_MULTITHREAD
-    std::vector<std::pair<int, int> > surfacePixelBins[NUM_THREADS];
+    std::vector<int> surfacePixelBins[NUM_THREADS];
 #endif
-    std::vector<std::pair<int, int> > strandedPixels;
+    std::vector<int> strandedPixels;
+    // the pixels of all patches, grouped by patch (see Patch::pixelBegin)
+    std::vector<int> patchPixels;
+    std::vector<int> patchPixelsScratch;
+    // scratch of TriangleSurfaceConnectLabeling()
+    SurfaceLabeling* surfaceLabeling;
+    std::vector<int> pixelRoots;
+    std::vector<int> rootLabels;
 
     cv::Mat markedMap;
     cv::Mat distFieldMapInput;
@@ -329,7 +480,7 @@ private:
     cv::Mat distTransMap;
 
     INT32DTarget* sharpEdgeLineTarget;
-    INT32DTarget* triangleIDTarget;
+    INT32R32FDTarget* triangleIDTarget;
     INT32DTarget* patchIDTarget;
     INT32DTarget* lineMapTarget;
     RGBADTarget* outputTarget;
@@ -340,6 +491,19 @@ private:
 
     unsigned int labelSSBO;
 
+    // model geometry kept on the CPU for the software rasterizer and the GPU uploads
+    std::vector<float> meshVertices;
+    std::vector<unsigned int> meshIndices;
+    SoftwareRasterizer* softwareRasterizer;
+
+    // model geometry resident on the GPU, uploaded once per LoadModel()
+    StandardVertexAttribute* meshAttribute;
+    StandardVertexAttribute* sharpEdgeAttribute;
+    bool modelBuffersDirty;
+
+    // OpenMP thread count of the caller, restored by EndRender(), 0 if numThreads did not change it
+    int savedNumThreads;
+
 }; // class BWAbstraction
 
 } // namespace bwabstraction
@@ -0,0 +1,251 @@
+#include "congruency.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <Eigen/Eigen>
+
+using namespace bwabstraction;
+using namespace std;
+using namespace Eigen;
+
+/**
+ * @brief RotatePoint
+ * The per-vertex operation of TriMesh::RotateNoNormalUpdate(), so that the transformed points
+ * are bit-identical to the ones of a rotated mesh copy.
+ */
+static inline TriMesh::Point RotatePoint(const TriMesh::Point &center, const Matrix3d &R, const TriMesh::Point &v)
+{
+    Vector3d localV = Vector3d(v[0] - center[0], v[1] - center[1], v[2] - center[2]);
+    Vector3d rotV = R * localV;
+    return TriMesh::Point(rotV(0) + center[0], rotV(1) + center[1], rotV(2) + center[2]);
+}
+
+PointGrid::PointGrid() : cellSize(1.0)
+{
+    dims[0] = dims[1] = dims[2] = 0;
+}
+
+/**
+ * @brief PointGrid::Build
+ * Sort mesh vertices into grid cells.
+ * @param pMesh The mesh.
+ * @param pVertices The indices of the vertices, at least one.
+ */
+void PointGrid::Build(TriMesh *pMesh, const vector<int> &pVertices)
+{
+    const int n = static_cast<int>(pVertices.size());
+    TriMesh::Point maxCorner;
+    minCorner = maxCorner = pMesh->point(TriMesh::VertexHandle(pVertices[0]));
+    for(int k = 0; k < n; ++k)
+    {
+        const TriMesh::Point &p = pMesh->point(TriMesh::VertexHandle(pVertices[k]));
+        minCorner.minimize(p);
+        maxCorner.maximize(p);
+    }
+    TriMesh::Point extent = maxCorner - minCorner;
+    double maxExtent = max(extent[0], max(extent[1], extent[2]));
+
+    // start from cubic cells and shrink them until flat or thin shapes get enough cells too
+    cellSize = maxExtent > 0.0 ? maxExtent / cbrt(static_cast<double>(n)) : 1.0;
+    for(int iteration = 0; iteration < 32; ++iteration)
+    {
+        double cells = 1.0;
+        for(int i = 0; i < 3; ++i)
+        {
+            cells *= max(1.0, ceil(extent[i] / cellSize));
+        }
+        if(maxExtent == 0.0 || cells * 2.0 >= n)
+        {
+            break;
+        }
+        cellSize *= 0.75;
+    }
+    for(int i = 0; i < 3; ++i)
+    {
+        dims[i] = max(1, static_cast<int>(ceil(extent[i] / cellSize)));
+    }
+
+    // counting sort by cell
+    vector<int> cellOfPoint(n);
+    cellStart.assign(dims[0] * dims[1] * dims[2] + 1, 0);
+    for(int k = 0; k < n; ++k)
+    {
+        const TriMesh::Point &p = pMesh->point(TriMesh::VertexHandle(pVertices[k]));
+        int cell = (CellCoordinate(p[2], 2) * dims[1] + CellCoordinate(p[1], 1)) * dims[0] + CellCoordinate(p[0], 0);
+        cellOfPoint[k] = cell;
+        ++cellStart[cell + 1];
+    }
+    for(size_t c = 1; c < cellStart.size(); ++c)
+    {
+        cellStart[c] += cellStart[c - 1];
+    }
+    vector<int> cursor(cellStart.begin(), cellStart.end() - 1);
+    points.resize(n);
+    for(int k = 0; k < n; ++k)
+    {
+        points[cursor[cellOfPoint[k]]++] = pMesh->point(TriMesh::VertexHandle(pVertices[k]));
+    }
+}
+
+bool PointGrid::IsBuilt() const
+{
+    return !points.empty();
+}
+
+int PointGrid::CellCoordinate(double x, int axis) const
+{
+    double c = floor((x - minCorner[axis]) / cellSize);
+    if(!(c > 0.0))
+    {
+        return 0;
+    }
+    return c >= dims[axis] ? dims[axis] - 1 : static_cast<int>(c);
+}
+
+/**
+ * @brief PointGrid::NearestDistance2
+ * Visit the cells in rings of growing Chebyshev radius around the cell of p. The points of
+ * ring r are at least (r - 1) * cellSize away, which bounds the search.
+ */
+double PointGrid::NearestDistance2(const TriMesh::Point &p) const
+{
+    const int c[3] = { CellCoordinate(p[0], 0), CellCoordinate(p[1], 1), CellCoordinate(p[2], 2) };
+    const int maxRing = max(dims[0], max(dims[1], dims[2]));
+    double best = DBL_MAX;
+    int bestIndex = -1;
+    for(int r = 0; r <= maxRing; ++r)
+    {
+        if(bestIndex != -1 && r > 0)
+        {
+            // small margin so that rounding never prunes the true nearest vertex
+            double bound = (r - 1) * cellSize;
+            if(bound * bound > best * (1.0 + 1e-9))
+            {
+                break;
+            }
+        }
+        for(int z = max(0, c[2] - r); z <= min(dims[2] - 1, c[2] + r); ++z)
+        {
+            bool zBorder = abs(z - c[2]) == r;
+            for(int y = max(0, c[1] - r); y <= min(dims[1] - 1, c[1] + r); ++y)
+            {
+                bool border = zBorder || abs(y - c[1]) == r;
+                // inside the ring only the two cells at x = c[0] +- r are on its surface
+                int step = border ? 1 : max(1, 2 * r);
+                for(int x = c[0] - r; x <= c[0] + r; x += step)
+                {
+                    if(x < 0 || x >= dims[0])
+                    {
+                        continue;
+                    }
+                    int cell = (z * dims[1] + y) * dims[0] + x;
+                    for(int i = cellStart[cell]; i < cellStart[cell + 1]; ++i)
+                    {
+                        double d2 = (p - points[i]).sqrnorm();
+                        if(d2 < best)
+                        {
+                            best = d2;
+                            bestIndex = i;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    double dis = (p - points[bestIndex]).length();
+    return dis * dis;
+}
+
+/**
+ * @brief Congruency::IsCongruent
+ * Static function. Align the OBB of the object with the OBB of the reference, then try the four
+ * orientations that keep the axes and accept the first one whose root mean squared distance to
+ * the nearest reference vertices is below 3% of the reference size. The object vertices are
+ * transformed on the fly and a trial stops as soon as its partial sum proves it too large.
+ * Component::BuildOBB() must have been called on both components.
+ * @param pMesh The mesh both components belong to.
+ * @param pReference The reference component.
+ * @param pReferenceGrid The vertices of pReference.
+ * @param pObject The component compared to the reference.
+ * @return true if the components are congruent.
+ */
+bool Congruency::IsCongruent(TriMesh *pMesh, const Component &pReference, const PointGrid &pReferenceGrid, const Component &pObject)
+{
+    TriMesh::Point refOrigin = pReference.obb.origin;
+    TriMesh::Point refSize = pReference.obb.max - pReference.obb.min;
+    TriMesh::Point refAxes[3];
+    refAxes[0] = pReference.obb.maxAxis;
+    refAxes[1] = pReference.obb.midAxis;
+    refAxes[2] = pReference.obb.minAxis;
+
+    TriMesh::Point objOrigin = pObject.obb.origin;
+    TriMesh::Point objAxes[3];
+    objAxes[0] = pObject.obb.maxAxis;
+    objAxes[1] = pObject.obb.midAxis;
+    objAxes[2] = pObject.obb.minAxis;
+
+    double shapeTolerance = refSize.length() * 0.03;
+
+    // align w.r.t. reference obb axis
+    Matrix3d refBasisMat = Matrix3d::Zero();
+    Matrix3d objBasisMat = Matrix3d::Zero();
+    for(int i = 0; i < 3; ++i)
+    {
+        for(int j = 0; j < 3; ++j)
+        {
+            refBasisMat(i, j) = refAxes[j][i];
+            objBasisMat(i, j) = objAxes[j][i];
+        }
+    }
+    Matrix3d R = refBasisMat * objBasisMat.inverse();
+
+    // half turns around the reference axes, as in TriMesh::RotateNoNormalUpdate()
+    Matrix3d flips[3];
+    for(int i = 0; i < 3; ++i)
+    {
+        Vector3d v(refAxes[i][0], refAxes[i][1], refAxes[i][2]);
+        v.normalize();
+        flips[i] = AngleAxisd(M_PI, v).toRotationMatrix();
+    }
+
+    // translate object vertices to the reference so that the origins match, then rotate
+    TriMesh::Point t = refOrigin - objOrigin;
+    vector<TriMesh::Point> aligned;
+    aligned.reserve(pObject.vertices.size());
+    for(size_t k = 0; k < pObject.vertices.size(); ++k)
+    {
+        aligned.push_back(RotatePoint(refOrigin, R, pMesh->point(TriMesh::VertexHandle(pObject.vertices[k])) + t));
+    }
+
+    // try different orientations, compute ROOT MEAN SQUARED DISTANCE
+    const double n = static_cast<double>(aligned.size());
+    // the partial sums only grow, so once sqrt(sum / n) reaches the tolerance the trial fails.
+    // exitSum is a cheap lower bound of that point.
+    const double exitSum = shapeTolerance * shapeTolerance * n * (1.0 - 1e-9);
+    for(int i = 0; i < 4; ++i)
+    {
+        double RMSD = 0;
+        bool exceeded = false;
+        for(size_t k = 0; k < aligned.size(); ++k)
+        {
+            TriMesh::Point v = i == 0 ? aligned[k] : RotatePoint(refOrigin, flips[i - 1], aligned[k]);
+            RMSD += pReferenceGrid.NearestDistance2(v);
+            if(RMSD > exitSum && sqrt(RMSD / n) >= shapeTolerance)
+            {
+                exceeded = true;
+                break;
+            }
+        }
+        if(exceeded)
+        {
+            continue;
+        }
+        RMSD /= n;
+        RMSD = sqrt(RMSD);
+        if(RMSD < shapeTolerance)
+        {
+            return true;
+        }
+    }
+    return false;
+}
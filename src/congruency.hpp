@@ -0,0 +1,55 @@
+#ifndef CONGRUENCY_H
+#define CONGRUENCY_H
+
+#include <vector>
+#include "trimesh.hpp"
+#include "mesh_segmentation.hpp"
+
+namespace bwabstraction
+{
+
+/**
+ * @brief The PointGrid class buckets a set of mesh vertices into a uniform grid for exact
+ * nearest vertex queries. The cell size is chosen so that there are about as many cells as
+ * vertices, which also works for flat or elongated components.
+ */
+class PointGrid
+{
+
+public:
+
+    PointGrid();
+
+    void Build(TriMesh *pMesh, const std::vector<int> &pVertices);
+    bool IsBuilt() const;
+    // squared distance to the nearest vertex, computed as (p - q).length() squared
+    double NearestDistance2(const TriMesh::Point &p) const;
+
+private:
+
+    int CellCoordinate(double x, int axis) const;
+
+    TriMesh::Point minCorner;
+    double cellSize;
+    int dims[3];
+    // points of cell c are points[cellStart[c], cellStart[c + 1])
+    std::vector<int> cellStart;
+    std::vector<TriMesh::Point> points;
+
+};
+
+/**
+ * @brief The Congruency class decides whether two components have the same shape.
+ */
+class Congruency
+{
+
+public:
+
+    static bool IsCongruent(TriMesh *pMesh, const Component &pReference, const PointGrid &pReferenceGrid, const Component &pObject);
+
+};
+
+} // namespace bwabstraction
+
+#endif // CONGRUENCY_H
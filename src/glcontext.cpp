@@ -0,0 +1,342 @@
+#include "glcontext.hpp"
+#include "bwabstraction.hpp"
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#ifdef BWA_WITH_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifdef BWA_WITH_OSMESA
+#include <GL/osmesa.h>
+#endif
+
+using namespace bwabstraction;
+using namespace std;
+
+namespace
+{
+
+// glfwInit() and the window hints are process-wide state
+std::mutex glfwMutex;
+
+/**
+ * @brief The GLFWContext class creates a hidden 1x1 GLFW window. Needs a display server.
+ */
+class GLFWContext : public GLContext
+{
+
+public:
+
+    GLFWContext() : window(NULL) {}
+
+    ~GLFWContext()
+    {
+        if (window)
+        {
+            glfwDestroyWindow(window);
+        }
+    }
+
+    bool Create()
+    {
+        std::lock_guard<std::mutex> lock(glfwMutex);
+        // glfwInit() is a no-op if GLFW is already initialized. we never call glfwTerminate()
+        // since it would destroy the windows of the other instances.
+        if (!glfwInit())
+        {
+            return false;
+        }
+
+        // try to create OpenGL 4.5 context
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        window = glfwCreateWindow(1, 1, "GLFW", NULL, NULL);
+        if (!window)
+        {
+            // fall back to 4.1
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+            glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+            glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+            window = glfwCreateWindow(1, 1, "GLFW", NULL, NULL);
+            if (!window)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool MakeCurrent()
+    {
+        glfwMakeContextCurrent(window);
+        return true;
+    }
+
+    void DoneCurrent()
+    {
+        glfwMakeContextCurrent(NULL);
+    }
+
+    bool UsesWindowSystem()
+    {
+        return true;
+    }
+
+private:
+
+    GLFWwindow* window;
+
+};
+
+#ifdef BWA_WITH_EGL
+
+/**
+ * @brief The EGLSurfacelessContext class creates a surfaceless EGL context (EGL_MESA_platform_surfaceless).
+ * Works without any display server, e.g. with Mesa llvmpipe or a headless GPU driver.
+ */
+class EGLSurfacelessContext : public GLContext
+{
+
+public:
+
+    EGLSurfacelessContext() : display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT) {}
+
+    ~EGLSurfacelessContext()
+    {
+        if (context != EGL_NO_CONTEXT)
+        {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(display, context);
+        }
+        // no eglTerminate(), the display handle is shared by all instances of the process
+    }
+
+    bool Create()
+    {
+        // prefer the surfaceless platform, fall back to the default display
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (getPlatformDisplay)
+        {
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        }
+        if (display == EGL_NO_DISPLAY)
+        {
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        }
+        EGLint major, minor;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+        {
+            display = EGL_NO_DISPLAY;
+            return false;
+        }
+        if (!eglBindAPI(EGL_OPENGL_API))
+        {
+            return false;
+        }
+
+        const EGLint configAttribs[] =
+        {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint numConfigs = 0;
+        if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+        {
+            return false;
+        }
+
+        // try to create OpenGL 4.5 context, fall back to 4.1
+        const EGLint versions[][2] = { { 4, 5 }, { 4, 1 } };
+        for (int i = 0; i < 2 && context == EGL_NO_CONTEXT; ++i)
+        {
+            const EGLint contextAttribs[] =
+            {
+                EGL_CONTEXT_MAJOR_VERSION, versions[i][0],
+                EGL_CONTEXT_MINOR_VERSION, versions[i][1],
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_NONE
+            };
+            context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+        }
+        return context != EGL_NO_CONTEXT;
+    }
+
+    bool MakeCurrent()
+    {
+        // no surface at all, rendering goes to framebuffer objects only
+        return eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context) == EGL_TRUE;
+    }
+
+    void DoneCurrent()
+    {
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    }
+
+    bool UsesWindowSystem()
+    {
+        return false;
+    }
+
+private:
+
+    EGLDisplay display;
+    EGLContext context;
+
+};
+
+#endif // BWA_WITH_EGL
+
+#ifdef BWA_WITH_OSMESA
+
+/**
+ * @brief The OSMesaSoftwareContext class creates a pure software context through Mesa's off-screen interface.
+ */
+class OSMesaSoftwareContext : public GLContext
+{
+
+public:
+
+    OSMesaSoftwareContext() : context(NULL), buffer(4, 0) {}
+
+    ~OSMesaSoftwareContext()
+    {
+        if (context)
+        {
+            OSMesaDestroyContext(context);
+        }
+    }
+
+    bool Create()
+    {
+        // try to create OpenGL 4.5 context, fall back to 4.1
+        const int versions[][2] = { { 4, 5 }, { 4, 1 } };
+        for (int i = 0; i < 2 && context == NULL; ++i)
+        {
+            const int attribs[] =
+            {
+                OSMESA_FORMAT, OSMESA_RGBA,
+                OSMESA_DEPTH_BITS, 24,
+                OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+                OSMESA_CONTEXT_MAJOR_VERSION, versions[i][0],
+                OSMESA_CONTEXT_MINOR_VERSION, versions[i][1],
+                0
+            };
+            context = OSMesaCreateContextAttribs(attribs, NULL);
+        }
+        return context != NULL;
+    }
+
+    bool MakeCurrent()
+    {
+        // OSMesa needs a color buffer to bind, a single pixel is enough since we render to FBOs
+        return OSMesaMakeCurrent(context, buffer.data(), GL_UNSIGNED_BYTE, 1, 1) == GL_TRUE;
+    }
+
+    void DoneCurrent()
+    {
+        OSMesaMakeCurrent(NULL, NULL, 0, 0, 0);
+    }
+
+    bool UsesWindowSystem()
+    {
+        return false;
+    }
+
+private:
+
+    OSMesaContext context;
+    vector<unsigned char> buffer;
+
+};
+
+#endif // BWA_WITH_OSMESA
+
+} // namespace
+
+/**
+ * @brief GLContext::Create
+ * Create an offscreen context with the given backend. The context is not made current.
+ * @param backend One of ContextBackend.
+ * @param verbose Print the reason of a failure.
+ * @return The new context, or NULL if the backend is unavailable or the creation failed.
+ */
+GLContext* GLContext::Create(int backend, bool verbose)
+{
+    if (backend == ContextBackend::GLFW)
+    {
+        GLFWContext* context = new GLFWContext();
+        if (context->Create())
+        {
+            return context;
+        }
+        delete context;
+    }
+    else if (backend == ContextBackend::EGL)
+    {
+#ifdef BWA_WITH_EGL
+        EGLSurfacelessContext* context = new EGLSurfacelessContext();
+        if (context->Create())
+        {
+            return context;
+        }
+        delete context;
+#else
+        if (verbose)
+        {
+            cout << "EGL backend is not available, rebuild with BWA_WITH_EGL." << endl;
+        }
+        return NULL;
+#endif
+    }
+    else if (backend == ContextBackend::OSMESA)
+    {
+#ifdef BWA_WITH_OSMESA
+        OSMesaSoftwareContext* context = new OSMesaSoftwareContext();
+        if (context->Create())
+        {
+            return context;
+        }
+        delete context;
+#else
+        if (verbose)
+        {
+            cout << "OSMesa backend is not available, rebuild with BWA_WITH_OSMESA." << endl;
+        }
+        return NULL;
+#endif
+    }
+
+    if (verbose)
+    {
+        cout << "Cannot create OpenGL context with the " << BackendName(backend) << " backend." << endl;
+    }
+    return NULL;
+}
+
+const char* GLContext::BackendName(int backend)
+{
+    switch (backend)
+    {
+    case ContextBackend::GLFW:
+        return "GLFW";
+    case ContextBackend::EGL:
+        return "EGL";
+    case ContextBackend::OSMESA:
+        return "OSMesa";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef GLCONTEXT_H
+#define GLCONTEXT_H
+
+namespace bwabstraction
+{
+
+/**
+ * @brief The GLContext class owns an offscreen OpenGL context created by one of the
+ * supported backends (see ContextBackend in bwabstraction.hpp).
+ * BWAbstraction only renders into its own framebuffer objects, so none of the backends
+ * needs a visible surface. EGL and OSMesa are only available when the library is built
+ * with BWA_WITH_EGL or BWA_WITH_OSMESA.
+ * Every BWAbstraction instance owns one context. EGL and OSMesa contexts can be created and
+ * used on any thread, GLFW only allows creating windows on the main thread.
+ */
+class GLContext
+{
+
+public:
+
+    static GLContext* Create(int backend, bool verbose);
+    static const char* BackendName(int backend);
+
+    virtual ~GLContext() {}
+    virtual bool MakeCurrent() = 0;
+    // release the context from the calling thread so that another thread can make it current
+    virtual void DoneCurrent() = 0;
+    // true if GLEW has to be initialized through glewInit() (window-system backed context),
+    // false if only the context-level glewContextInit() is safe to call.
+    virtual bool UsesWindowSystem() = 0;
+
+};
+
+} // namespace bwabstraction
+
+#endif // GLCONTEXT_H
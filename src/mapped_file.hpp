@@ -0,0 +1,143 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace bwabstraction
+{
+
+/**
+ * @brief The MappedFile class maps a whole file read-only into memory.
+ */
+class MappedFile
+{
+
+public:
+
+    MappedFile() : data(NULL), size(0)
+    {
+#ifdef _WIN32
+        file = INVALID_HANDLE_VALUE;
+        mapping = NULL;
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (data)
+        {
+            UnmapViewOfFile(data);
+        }
+        if (mapping)
+        {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+        }
+#else
+        if (data)
+        {
+            munmap(const_cast<char*>(data), size);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * @brief Open
+     * @return false if the file cannot be mapped or is empty.
+     */
+    bool Open(const std::string &path)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+        {
+            return false;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping)
+        {
+            return false;
+        }
+        data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        size = static_cast<size_t>(fileSize.QuadPart);
+        return data != NULL;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close(fd);
+            return false;
+        }
+        void* mapped = mmap(NULL, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            return false;
+        }
+        data = static_cast<const char*>(mapped);
+        size = static_cast<size_t>(st.st_size);
+        return true;
+#endif
+    }
+
+    const char* data;
+    size_t size;
+
+private:
+
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+
+};
+
+// the files read through MappedFile keep their arrays 8-byte aligned
+
+inline size_t Align8(size_t size)
+{
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+template<typename T> void WriteAligned8(std::ofstream &out, const T* data, size_t count)
+{
+    static const char padding[8] = { 0 };
+    size_t bytes = count * sizeof(T);
+    out.write(reinterpret_cast<const char*>(data), bytes);
+    out.write(padding, Align8(bytes) - bytes);
+}
+
+} // namespace bwabstraction
+
+#endif // MAPPEDFILE_H
@@ -1,99 +1,124 @@
 #include "mesh_segmentation.hpp"
-#include <queue>
+#include "unionfind.hpp"
 
 using namespace bwabstraction;
 using namespace std;
 using namespace OpenMesh;
 
 /**
- * @brief MeshSegmentation::AddFace
- * Static function. Add a face from an original mesh to a submesh.
- * @param pMesh The original mesh.
- * @param pSubmesh A submesh of pMesh.
- * @param pVertexHandleMap A hashmap mapping from original mesh vertex index to submesh vertex index. Used to prevent adding redundant vertex.
- * @param pFace The face handle of the face in the original mesh that is to be added to the submesh.
+ * @brief MeshSegmentation::ComponentSegmentation
+ * Segment a mesh by connectivity only. Faces sharing an edge are merged by a parallel
+ * union-find, then the components are listed by SplitComponents().
+ * @param pMesh The mesh that is to be segmented.
+ * @return An array of components.
  */
-void MeshSegmentation::AddFace(TriMesh *pMesh, TriMesh *pSubmesh, unordered_map<int, int> &pVertexHandleMap, FaceHandle pFace)
+vector<Component> MeshSegmentation::ComponentSegmentation(TriMesh *pMesh, FPropHandleT<unsigned int> fPropComponentID)
 {
-    vector<VertexHandle> faceVertexHandles;
-    for(TriMesh::FaceVertexIter fvit = pMesh->fv_iter(pFace); fvit.is_valid(); ++fvit)
+    const int numFaces = static_cast<int>(pMesh->n_faces());
+    const int numEdges = static_cast<int>(pMesh->n_edges());
+
+    // the root of each set is its smallest face
+    UnionFind faceSets;
+    faceSets.Reset(numFaces);
+    #pragma omp parallel for
+    for(int e = 0; e < numEdges; ++e)
     {
-        VertexHandle vh;
-        if(pVertexHandleMap.count(fvit->idx()) == 0)
+        EdgeHandle eh(e);
+        FaceHandle f1 = pMesh->face_handle(pMesh->halfedge_handle(eh, 0));
+        FaceHandle f2 = pMesh->face_handle(pMesh->halfedge_handle(eh, 1));
+        if(f1.is_valid() && f2.is_valid())
         {
-            vh = pSubmesh->add_vertex(pMesh->point(*fvit));
-            pVertexHandleMap[fvit->idx()] = vh.idx();
+            faceSets.Unite(f1.idx(), f2.idx());
         }
-        else
-        {
-            vh = pSubmesh->vertex_handle(pVertexHandleMap[fvit->idx()]);
-        }
-        faceVertexHandles.push_back(vh);
     }
-    pSubmesh->add_face(faceVertexHandles);
+    vector<int> roots(numFaces);
+    #pragma omp parallel for
+    for(int f = 0; f < numFaces; ++f)
+    {
+        roots[f] = faceSets.Find(f);
+    }
+
+    // number the components in the order of their first face, as region growing from each
+    // unlabeled face in turn would. 0 is invalid segment id.
+    unsigned int segId = 0;
+    for(int f = 0; f < numFaces; ++f)
+    {
+        FaceHandle root(roots[f]);
+        unsigned int id = roots[f] == f ? ++segId : pMesh->property(fPropComponentID, root);
+        pMesh->property(fPropComponentID, FaceHandle(f)) = id;
+    }
+
+    return SplitComponents(pMesh, fPropComponentID, static_cast<int>(segId));
 }
 
 /**
- * @brief MeshSegmentation::ComponentSegmentation
- * Segment a mesh by connectivity only.
- * @param pMesh The mesh that is to be segmented.
- * @return An array of submeshes.
+ * @brief MeshSegmentation::SplitComponents
+ * List the vertices of each component of a mesh whose faces are labeled already. The faces are
+ * sorted by component first, then the components are gathered in parallel.
+ * @param pMesh The labeled mesh.
+ * @param fPropComponentID The 1-based component ID of each face.
+ * @param pComponentCount The number of components.
+ * @return An array of components, the component of ID i at index i - 1.
  */
-vector<TriMesh *> MeshSegmentation::ComponentSegmentation(TriMesh *pMesh, FPropHandleT<unsigned int> fPropComponentID)
+vector<Component> MeshSegmentation::SplitComponents(TriMesh *pMesh, FPropHandleT<unsigned int> fPropComponentID, int pComponentCount)
 {
+    const int numFaces = static_cast<int>(pMesh->n_faces());
+    const int numVertices = static_cast<int>(pMesh->n_vertices());
 
-    // Label each face by region growing, and create a submesh in the process.
-    vector<TriMesh *> submeshes;
-    unordered_map<int, int> vertexHandleMap;
-    unsigned int segId = 0;
-    for(TriMesh::FaceIter fit = pMesh->faces_begin(); fit != pMesh->faces_end(); ++fit)
+    // counting sort of the faces by component
+    vector<int> componentStart(pComponentCount + 1, 0);
+    for(int f = 0; f < numFaces; ++f)
     {
-        // Have this face been labeled yet? 0 is invalid segment id.
-        if(pMesh->property(fPropComponentID, *fit) != 0)
-        {
-            continue;
-        }
-        segId++;
+        ++componentStart[pMesh->property(fPropComponentID, FaceHandle(f))];
+    }
+    for(int c = 0; c < pComponentCount; ++c)
+    {
+        componentStart[c + 1] += componentStart[c];
+    }
+    vector<int> componentFaces(numFaces);
+    vector<int> cursor(componentStart.begin(), componentStart.end() - 1);
+    for(int f = 0; f < numFaces; ++f)
+    {
+        componentFaces[cursor[pMesh->property(fPropComponentID, FaceHandle(f)) - 1]++] = f;
+    }
 
-        // Region growing by BFS, and create a submesh in the process.
-        TriMesh *submesh = new TriMesh;
-        vertexHandleMap.clear();
-        queue<FaceHandle> q;
-        q.push(*fit);
-        AddFace(pMesh, submesh, vertexHandleMap, *fit);
-        pMesh->property(fPropComponentID, *fit) = segId;
-        while(!q.empty())
+    vector<Component> components(pComponentCount);
+    #pragma omp parallel
+    {
+        // the last component that listed each vertex. a vertex can belong to several
+        // components if they only touch at the vertex.
+        vector<int> lastComponent(numVertices, -1);
+        #pragma omp for schedule(dynamic, 16)
+        for(int c = 0; c < pComponentCount; ++c)
         {
-            FaceHandle f = q.front();
-            q.pop();
-            for(TriMesh::FaceHalfedgeIter fhit = pMesh->fh_iter(f); fhit.is_valid(); ++fhit)
+            vector<int> &vertices = components[c].vertices;
+            for(int i = componentStart[c]; i < componentStart[c + 1]; ++i)
             {
-                FaceHandle f2 = pMesh->opposite_face_handle(*fhit);
-                if(f2.is_valid() && pMesh->property(fPropComponentID, f2) == 0)
+                for(TriMesh::FaceVertexIter fvit = pMesh->fv_iter(FaceHandle(componentFaces[i])); fvit.is_valid(); ++fvit)
                 {
-                    q.push(f2);
-                    AddFace(pMesh, submesh, vertexHandleMap, f2);
-                    pMesh->property(fPropComponentID, f2) = segId;
+                    if(lastComponent[fvit->idx()] != c)
+                    {
+                        lastComponent[fvit->idx()] = c;
+                        vertices.push_back(fvit->idx());
+                    }
                 }
             }
+            vector<int>(vertices).swap(vertices);
         }
-        submesh->update_normals();
-        submeshes.push_back(submesh);
     }
-
-    return submeshes;
+    return components;
 }
 
 /**
- * @brief MeshSegmentation::FreeSubmeshVector
- * Free an array of submeshes.
- * @param pSubmeshes The array of submeshes that is to be freed.
+ * @brief Component::BuildOBB
+ * @param pMesh The mesh the component belongs to.
  */
-void MeshSegmentation::FreeSubmeshVector(vector<TriMesh *> &pSubmeshes)
+void Component::BuildOBB(TriMesh *pMesh)
 {
-    for(vector<TriMesh *>::iterator it = pSubmeshes.begin(); it != pSubmeshes.end(); ++it)
+    vector<TriMesh::Point> points(vertices.size());
+    for(size_t i = 0; i < vertices.size(); ++i)
     {
-        delete *it;
+        points[i] = pMesh->point(VertexHandle(vertices[i]));
     }
-    pSubmeshes.clear();
+    obb.Build(points);
 }
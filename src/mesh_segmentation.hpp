@@ -2,28 +2,35 @@
 #define MESHSEGMENTATION_H
 
 #include <vector>
-#include <unordered_map>
 #include "trimesh.hpp"
 
 namespace bwabstraction
 {
 
+/**
+ * @brief The Component struct is a part of a mesh, given by the indices of its vertices in the
+ * mesh instead of a copy. The vertices are listed in the order the faces first use them.
+ */
+typedef struct _Component
+{
+    std::vector<int> vertices;
+    TriMesh::OBB obb;
+
+    void BuildOBB(TriMesh *pMesh);
+} Component;
+
 /**
  * @brief The MeshSegmentation class implements mesh segmentation algorithms for TriMesh objects.
- * Given a TriMesh object, the MeshSegmentation class provides methods to segment it into submeshes.
- * The result submeshes are returned as a vector of TriMesh objects.
+ * Given a TriMesh object, the MeshSegmentation class provides methods to segment it into components.
+ * The result components are returned as a vector of Component objects that refer to the mesh.
  */
 class MeshSegmentation
 {
 
 public:
 
-    static std::vector<TriMesh *> ComponentSegmentation(TriMesh *pMesh, OpenMesh::FPropHandleT<unsigned int> fPropComponentID);
-    static void FreeSubmeshVector(std::vector<TriMesh *> &pSubmeshes);
-
-private:
-
-    static void AddFace(TriMesh *pMesh, TriMesh *pSubmesh, std::unordered_map<int, int> &pVertexHandleMap, OpenMesh::FaceHandle pFace);
+    static std::vector<Component> ComponentSegmentation(TriMesh *pMesh, OpenMesh::FPropHandleT<unsigned int> fPropComponentID);
+    static std::vector<Component> SplitComponents(TriMesh *pMesh, OpenMesh::FPropHandleT<unsigned int> fPropComponentID, int pComponentCount);
 
 };
 
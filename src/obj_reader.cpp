@@ -0,0 +1,390 @@
+#include "obj_reader.hpp"
+#include "mapped_file.hpp"
+#include "threads.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+
+using namespace bwabstraction;
+using namespace std;
+
+// chunks are at least this large, so that small files are not split at all
+#define MIN_CHUNK_SIZE (1 << 20)
+
+namespace
+{
+
+typedef struct _Chunk
+{
+    const char* begin;
+    const char* end;
+    bool ok;
+    vector<float> positions;
+    vector<int> faceSizes;
+    // absolute indices are final, relative ones are local to the chunk until merged
+    vector<int> faceIndices;
+    vector<size_t> relativeSlots;
+    float minCorner[3];
+    float maxCorner[3];
+} Chunk;
+
+// the powers of ten that are exact doubles
+const double powersOfTen[] =
+{
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline bool IsBlank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+inline bool IsLineEnd(char c)
+{
+    return c == '\n' || c == '\r';
+}
+
+inline bool IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+inline void SkipBlanks(const char* &p, const char* end)
+{
+    while (p < end && IsBlank(*p))
+    {
+        ++p;
+    }
+}
+
+/**
+ * @brief ParseFloat
+ * Decimal numbers with at most 2^53 as mantissa and a power of ten up to 22 are converted
+ * exactly with a single multiplication or division, everything else goes through strtod().
+ */
+bool ParseFloat(const char* &p, const char* end, float &value)
+{
+    const char* start = p;
+    const char* q = p;
+    bool negative = false;
+    if (q < end && (*q == '-' || *q == '+'))
+    {
+        negative = *q == '-';
+        ++q;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool anyDigit = false;
+    for (; q < end && IsDigit(*q); ++q)
+    {
+        anyDigit = true;
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*q - '0');
+            digits += mantissa != 0;
+        }
+        else
+        {
+            ++exponent;
+        }
+    }
+    if (q < end && *q == '.')
+    {
+        for (++q; q < end && IsDigit(*q); ++q)
+        {
+            anyDigit = true;
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*q - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+        }
+    }
+
+    bool fast = anyDigit;
+    if (fast && q < end && (*q == 'e' || *q == 'E'))
+    {
+        const char* e = q + 1;
+        bool exponentNegative = false;
+        if (e < end && (*e == '-' || *e == '+'))
+        {
+            exponentNegative = *e == '-';
+            ++e;
+        }
+        if (e < end && IsDigit(*e))
+        {
+            int x = 0;
+            for (; e < end && IsDigit(*e); ++e)
+            {
+                if (x < 10000)
+                {
+                    x = x * 10 + (*e - '0');
+                }
+            }
+            exponent += exponentNegative ? -x : x;
+            q = e;
+        }
+        else
+        {
+            fast = false;
+        }
+    }
+
+    if (fast && mantissa <= (1ull << 53) && exponent >= -22 && exponent <= 22)
+    {
+        double d = static_cast<double>(mantissa);
+        d = exponent < 0 ? d / powersOfTen[-exponent] : d * powersOfTen[exponent];
+        value = static_cast<float>(negative ? -d : d);
+        p = q;
+        return true;
+    }
+
+    // the mapped file is not null-terminated
+    char token[64];
+    size_t length = 0;
+    while (start + length < end && length + 1 < sizeof(token) && !IsBlank(start[length]) && !IsLineEnd(start[length]))
+    {
+        token[length] = start[length];
+        ++length;
+    }
+    token[length] = '\0';
+    char* tokenEnd;
+    double d = strtod(token, &tokenEnd);
+    if (tokenEnd == token)
+    {
+        return false;
+    }
+    value = static_cast<float>(d);
+    p = start + (tokenEnd - token);
+    return true;
+}
+
+bool ParseIndex(const char* &p, const char* end, long long &value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        ++p;
+    }
+    if (p >= end || !IsDigit(*p))
+    {
+        return false;
+    }
+    value = 0;
+    for (; p < end && IsDigit(*p); ++p)
+    {
+        value = value * 10 + (*p - '0');
+        if (value > INT_MAX)
+        {
+            return false;
+        }
+    }
+    if (negative)
+    {
+        value = -value;
+    }
+    return true;
+}
+
+void ParseChunk(Chunk &chunk)
+{
+    const char* p = chunk.begin;
+    const char* end = chunk.end;
+    for (int i = 0; i < 3; ++i)
+    {
+        chunk.minCorner[i] = FLT_MAX;
+        chunk.maxCorner[i] = -FLT_MAX;
+    }
+    chunk.ok = true;
+
+    while (p < end)
+    {
+        SkipBlanks(p, end);
+        if (p + 1 < end && IsBlank(p[1]) && *p == 'v')
+        {
+            p += 2;
+            for (int i = 0; i < 3; ++i)
+            {
+                float x;
+                SkipBlanks(p, end);
+                if (!ParseFloat(p, end, x))
+                {
+                    chunk.ok = false;
+                    return;
+                }
+                chunk.positions.push_back(x);
+                chunk.minCorner[i] = min(chunk.minCorner[i], x);
+                chunk.maxCorner[i] = max(chunk.maxCorner[i], x);
+            }
+        }
+        else if (p + 1 < end && IsBlank(p[1]) && *p == 'f')
+        {
+            p += 2;
+            const long long localVertexCount = static_cast<long long>(chunk.positions.size() / 3);
+            const size_t first = chunk.faceIndices.size();
+            while (true)
+            {
+                SkipBlanks(p, end);
+                if (p >= end || IsLineEnd(*p) || *p == '#')
+                {
+                    break;
+                }
+                long long index;
+                if (!ParseIndex(p, end, index) || index == 0)
+                {
+                    chunk.ok = false;
+                    return;
+                }
+                if (index > 0)
+                {
+                    chunk.faceIndices.push_back(static_cast<int>(index - 1));
+                }
+                else
+                {
+                    chunk.relativeSlots.push_back(chunk.faceIndices.size());
+                    chunk.faceIndices.push_back(static_cast<int>(localVertexCount + index));
+                }
+                // skip the texture coordinate and normal indices
+                while (p < end && !IsBlank(*p) && !IsLineEnd(*p))
+                {
+                    ++p;
+                }
+            }
+            const size_t count = chunk.faceIndices.size() - first;
+            if (count >= 3)
+            {
+                chunk.faceSizes.push_back(static_cast<int>(count));
+            }
+            else
+            {
+                chunk.faceIndices.resize(first);
+                while (!chunk.relativeSlots.empty() && chunk.relativeSlots.back() >= first)
+                {
+                    chunk.relativeSlots.pop_back();
+                }
+            }
+        }
+
+        // skip the rest of the line
+        while (p < end && *p != '\n')
+        {
+            ++p;
+        }
+        if (p < end)
+        {
+            ++p;
+        }
+    }
+}
+
+} // namespace
+
+/**
+ * @brief ObjReader::Read
+ * Static function.
+ * @return false if the file cannot be read, a line cannot be parsed or a face index is out of range.
+ */
+bool ObjReader::Read(const string &pFilePath, Data &pData)
+{
+    MappedFile file;
+    if (!file.Open(pFilePath))
+    {
+        return false;
+    }
+
+    // split into chunks of whole lines
+    const size_t numChunks = max(static_cast<size_t>(1), min(static_cast<size_t>(MaxThreads()) * 4, file.size / MIN_CHUNK_SIZE));
+    const char* fileEnd = file.data + file.size;
+    vector<Chunk> chunks(numChunks);
+    const char* begin = file.data;
+    for (size_t k = 0; k < numChunks; ++k)
+    {
+        const char* end = k + 1 == numChunks ? fileEnd : max(begin, file.data + file.size / numChunks * (k + 1));
+        while (end < fileEnd && end[-1] != '\n')
+        {
+            ++end;
+        }
+        chunks[k].begin = begin;
+        chunks[k].end = end;
+        begin = end;
+    }
+
+    bool ok = true;
+    #pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for (int k = 0; k < static_cast<int>(numChunks); ++k)
+    {
+        ParseChunk(chunks[k]);
+        ok = ok && chunks[k].ok;
+    }
+    if (!ok)
+    {
+        return false;
+    }
+
+    // concatenate
+    vector<size_t> vertexOffsets(numChunks + 1, 0);
+    vector<size_t> faceOffsets(numChunks + 1, 0);
+    vector<size_t> indexOffsets(numChunks + 1, 0);
+    for (int i = 0; i < 3; ++i)
+    {
+        pData.minCorner[i] = FLT_MAX;
+        pData.maxCorner[i] = -FLT_MAX;
+    }
+    for (size_t k = 0; k < numChunks; ++k)
+    {
+        vertexOffsets[k + 1] = vertexOffsets[k] + chunks[k].positions.size() / 3;
+        faceOffsets[k + 1] = faceOffsets[k] + chunks[k].faceSizes.size();
+        indexOffsets[k + 1] = indexOffsets[k] + chunks[k].faceIndices.size();
+        for (int i = 0; i < 3; ++i)
+        {
+            pData.minCorner[i] = min(pData.minCorner[i], chunks[k].minCorner[i]);
+            pData.maxCorner[i] = max(pData.maxCorner[i], chunks[k].maxCorner[i]);
+        }
+    }
+    const long long numVertices = static_cast<long long>(vertexOffsets[numChunks]);
+    if (numVertices > INT_MAX || indexOffsets[numChunks] > static_cast<size_t>(INT_MAX))
+    {
+        return false;
+    }
+    pData.positions.resize(vertexOffsets[numChunks] * 3);
+    pData.faceStart.resize(faceOffsets[numChunks] + 1);
+    pData.faceIndices.resize(indexOffsets[numChunks]);
+
+    #pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+    for (int k = 0; k < static_cast<int>(numChunks); ++k)
+    {
+        Chunk &chunk = chunks[k];
+        copy(chunk.positions.begin(), chunk.positions.end(), pData.positions.begin() + vertexOffsets[k] * 3);
+
+        int* faceIndices = pData.faceIndices.data() + indexOffsets[k];
+        copy(chunk.faceIndices.begin(), chunk.faceIndices.end(), faceIndices);
+        for (size_t i = 0; i < chunk.relativeSlots.size(); ++i)
+        {
+            faceIndices[chunk.relativeSlots[i]] += static_cast<int>(vertexOffsets[k]);
+        }
+        for (size_t i = 0; i < chunk.faceIndices.size(); ++i)
+        {
+            ok = ok && faceIndices[i] >= 0 && faceIndices[i] < numVertices;
+        }
+
+        int start = static_cast<int>(indexOffsets[k]);
+        for (size_t f = 0; f < chunk.faceSizes.size(); ++f)
+        {
+            pData.faceStart[faceOffsets[k] + f] = start;
+            start += chunk.faceSizes[f];
+        }
+
+        // release the chunk early, large files hold it twice otherwise
+        vector<float>().swap(chunk.positions);
+        vector<int>().swap(chunk.faceIndices);
+    }
+    pData.faceStart.back() = static_cast<int>(indexOffsets[numChunks]);
+    return ok;
+}
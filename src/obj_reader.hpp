@@ -0,0 +1,39 @@
+#ifndef OBJREADER_H
+#define OBJREADER_H
+
+#include <string>
+#include <vector>
+
+namespace bwabstraction
+{
+
+/**
+ * @brief The ObjReader class parses the vertices and faces of a Wavefront OBJ file.
+ * The file is mapped into memory and split into chunks of whole lines that are parsed in
+ * parallel, then the chunks are concatenated and relative face indices are resolved.
+ * Everything except "v" and "f" lines is ignored.
+ */
+class ObjReader
+{
+
+public:
+
+    typedef struct _Data
+    {
+        // xyz per vertex, rounded to float like the OpenMesh OBJ reader does
+        std::vector<float> positions;
+        // the 0-based vertex indices of face f are faceIndices[faceStart[f], faceStart[f + 1])
+        std::vector<int> faceStart;
+        std::vector<int> faceIndices;
+        // bounds of the positions
+        float minCorner[3];
+        float maxCorner[3];
+    } Data;
+
+    static bool Read(const std::string &pFilePath, Data &pData);
+
+};
+
+} // namespace bwabstraction
+
+#endif // OBJREADER_H
@@ -0,0 +1,310 @@
+#include "precompute_cache.hpp"
+#include "mapped_file.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+using namespace bwabstraction;
+using namespace std;
+
+// bump whenever the cached data or its meaning changes
+#define CACHE_VERSION 4
+#define CACHE_BYTE_ORDER 0x01020304u
+
+#define FNV_OFFSET_BASIS 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+namespace
+{
+
+typedef struct _CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t meshHash;
+    float congruentThreshold;
+    uint32_t faceCount;
+    uint32_t componentCount;
+    uint32_t congruencyCount;
+    uint32_t sharpEdgeCount;
+    uint32_t reserved;
+} CacheHeader;
+
+const char cacheMagic[8] = { 'B', 'W', 'A', 'C', 'A', 'C', 'H', 'E' };
+
+// FNV-1a on 64-bit words instead of bytes, the input is made of 8-byte values anyway
+inline void HashWord(uint64_t &hash, uint64_t word)
+{
+    hash ^= word;
+    hash *= FNV_PRIME;
+}
+
+} // namespace
+
+PrecomputeCache::PrecomputeCache() :
+    faceCount(0),
+    componentCount(0),
+    congruencyCount(0),
+    sharpEdgeCount(0),
+    faceComponentIDs(NULL),
+    congruencies(NULL),
+    sharpEdges(NULL),
+    sharpEdgeCosines(NULL),
+    surfaceFaceVertices(NULL)
+{
+}
+
+/**
+ * @brief PrecomputeCache::HashMesh
+ * Static function. Hash the vertex positions and the face vertex indices of a mesh.
+ */
+unsigned long long PrecomputeCache::HashMesh(TriMesh *pMesh)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    HashWord(hash, pMesh->n_vertices());
+    HashWord(hash, pMesh->n_faces());
+    for(TriMesh::VertexIter vit = pMesh->vertices_begin(); vit != pMesh->vertices_end(); ++vit)
+    {
+        const TriMesh::Point &p = pMesh->point(*vit);
+        for(int i = 0; i < 3; ++i)
+        {
+            uint64_t word;
+            double value = p[i];
+            memcpy(&word, &value, sizeof(word));
+            HashWord(hash, word);
+        }
+    }
+    for(TriMesh::FaceIter fit = pMesh->faces_begin(); fit != pMesh->faces_end(); ++fit)
+    {
+        for(TriMesh::FaceVertexIter fvit = pMesh->fv_iter(*fit); fvit.is_valid(); ++fvit)
+        {
+            HashWord(hash, static_cast<uint64_t>(fvit->idx()));
+        }
+    }
+    return hash;
+}
+
+/**
+ * @brief PrecomputeCache::FilePath
+ * Static function. The cache file of a mesh and parameters inside pDirectory.
+ */
+string PrecomputeCache::FilePath(const string &pDirectory, unsigned long long pMeshHash, float pCongruentThreshold)
+{
+    uint32_t thresholdBits;
+    memcpy(&thresholdBits, &pCongruentThreshold, sizeof(thresholdBits));
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx_%08x.bwacache", pMeshHash, thresholdBits);
+    string path = pDirectory;
+    if (!path.empty() && path.back() != '/' && path.back() != '\\')
+    {
+        path += '/';
+    }
+    return path + name;
+}
+
+/**
+ * @brief PrecomputeCache::Open
+ * Map a cache file written by Save() and check that its indices are in range for pMesh.
+ * @return false if the file is missing, corrupt or belongs to another mesh, parameters or version.
+ */
+bool PrecomputeCache::Open(const string &pFilePath, TriMesh *pMesh, unsigned long long pMeshHash, float pCongruentThreshold)
+{
+    if (!file.Open(pFilePath) || file.size < sizeof(CacheHeader))
+    {
+        return false;
+    }
+
+    CacheHeader header;
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+        header.version != CACHE_VERSION ||
+        header.byteOrder != CACHE_BYTE_ORDER ||
+        header.meshHash != pMeshHash ||
+        header.congruentThreshold != pCongruentThreshold ||
+        header.faceCount != pMesh->n_faces() || header.faceCount > INT32_MAX / 3 ||
+        header.componentCount > INT32_MAX || header.congruencyCount > INT32_MAX / 2 ||
+        header.sharpEdgeCount > INT32_MAX / 6)
+    {
+        return false;
+    }
+
+    const size_t faceComponentIDsBytes = Align8(static_cast<size_t>(header.faceCount) * sizeof(unsigned int));
+    const size_t congruenciesBytes = Align8(static_cast<size_t>(header.congruencyCount) * 2 * sizeof(int));
+    const size_t sharpEdgesBytes = Align8(static_cast<size_t>(header.sharpEdgeCount) * 6 * sizeof(float));
+    const size_t cosinesBytes = Align8(static_cast<size_t>(header.sharpEdgeCount) * sizeof(float));
+    const size_t surfaceBytes = Align8(static_cast<size_t>(header.faceCount) * 3 * sizeof(int));
+    const size_t expectedSize = Align8(sizeof(CacheHeader)) + faceComponentIDsBytes + congruenciesBytes +
+        sharpEdgesBytes + cosinesBytes + surfaceBytes;
+    if (file.size != expectedSize)
+    {
+        return false;
+    }
+
+    const char* cursor = file.data + Align8(sizeof(CacheHeader));
+    const unsigned int* componentIDs = reinterpret_cast<const unsigned int*>(cursor);
+    cursor += faceComponentIDsBytes;
+    const int* componentPairs = reinterpret_cast<const int*>(cursor);
+    cursor += congruenciesBytes;
+    const float* edges = reinterpret_cast<const float*>(cursor);
+    cursor += sharpEdgesBytes;
+    const float* cosines = reinterpret_cast<const float*>(cursor);
+    cursor += cosinesBytes;
+    const int* faceVertices = reinterpret_cast<const int*>(cursor);
+
+    // out of range values would index outside of the components and the mesh later
+    bool valid = true;
+    const int numFaces = static_cast<int>(header.faceCount);
+    const int numComponents = static_cast<int>(header.componentCount);
+    const int numPairValues = static_cast<int>(header.congruencyCount) * 2;
+    const int numVertices = static_cast<int>(pMesh->n_vertices());
+    #pragma omp parallel for reduction(&&:valid)
+    for (int f = 0; f < numFaces; ++f)
+    {
+        valid = valid && componentIDs[f] >= 1 && componentIDs[f] <= header.componentCount;
+        for (int k = 0; k < 3; ++k)
+        {
+            valid = valid && faceVertices[f * 3 + k] >= 0 && faceVertices[f * 3 + k] < numVertices;
+        }
+    }
+    for (int i = 0; i < numPairValues; ++i)
+    {
+        valid = valid && componentPairs[i] >= 0 && componentPairs[i] < numComponents;
+    }
+    if (!valid)
+    {
+        return false;
+    }
+
+    faceCount = numFaces;
+    componentCount = numComponents;
+    congruencyCount = static_cast<int>(header.congruencyCount);
+    sharpEdgeCount = static_cast<int>(header.sharpEdgeCount);
+    faceComponentIDs = componentIDs;
+    congruencies = componentPairs;
+    sharpEdges = edges;
+    sharpEdgeCosines = cosines;
+    surfaceFaceVertices = faceVertices;
+    return true;
+}
+
+bool PrecomputeCache::IsOpen() const
+{
+    return faceComponentIDs != NULL;
+}
+
+int PrecomputeCache::FaceCount() const
+{
+    return faceCount;
+}
+
+const unsigned int* PrecomputeCache::FaceComponentIDs() const
+{
+    return faceComponentIDs;
+}
+
+int PrecomputeCache::ComponentCount() const
+{
+    return componentCount;
+}
+
+/**
+ * @brief PrecomputeCache::GetCongruencies
+ * The congruencies are stored as two ints each, std::pair does not guarantee that layout,
+ * so unlike the other arrays they are copied. There are fewer of them than components.
+ */
+void PrecomputeCache::GetCongruencies(vector<pair<int, int> > &pCongruencies) const
+{
+    pCongruencies.resize(congruencyCount);
+    for (int i = 0; i < congruencyCount; ++i)
+    {
+        pCongruencies[i] = pair<int, int>(congruencies[i * 2], congruencies[i * 2 + 1]);
+    }
+}
+
+int PrecomputeCache::SharpEdgeCount() const
+{
+    return sharpEdgeCount;
+}
+
+const float* PrecomputeCache::SharpEdges() const
+{
+    return sharpEdges;
+}
+
+const float* PrecomputeCache::SharpEdgeCosines() const
+{
+    return sharpEdgeCosines;
+}
+
+const int* PrecomputeCache::SurfaceFaceVertices() const
+{
+    return surfaceFaceVertices;
+}
+
+/**
+ * @brief PrecomputeCache::Save
+ * Static function. Write a cache file. The file is written under a temporary name and renamed,
+ * so that other processes never map a half-written file.
+ * @return false if the file could not be written.
+ */
+bool PrecomputeCache::Save(const string &pFilePath, unsigned long long pMeshHash, float pCongruentThreshold, const Data &pData)
+{
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = CACHE_VERSION;
+    header.byteOrder = CACHE_BYTE_ORDER;
+    header.meshHash = pMeshHash;
+    header.congruentThreshold = pCongruentThreshold;
+    header.faceCount = static_cast<uint32_t>(pData.faceCount);
+    header.componentCount = static_cast<uint32_t>(pData.componentCount);
+    header.congruencyCount = static_cast<uint32_t>(pData.congruencies->size());
+    header.sharpEdgeCount = static_cast<uint32_t>(pData.sharpEdgeCount);
+
+    vector<int> congruencies;
+    congruencies.reserve(pData.congruencies->size() * 2);
+    for (auto it = pData.congruencies->begin(); it != pData.congruencies->end(); ++it)
+    {
+        congruencies.push_back(it->first);
+        congruencies.push_back(it->second);
+    }
+
+    // unique per process and thread, several instances may save the same model at once
+    stringstream temporary;
+#ifdef _WIN32
+    temporary << pFilePath << ".tmp" << GetCurrentProcessId();
+#else
+    temporary << pFilePath << ".tmp" << getpid();
+#endif
+    temporary << "_" << hash<thread::id>()(this_thread::get_id());
+    string temporaryPath = temporary.str();
+    {
+        ofstream out(temporaryPath.c_str(), ios::binary | ios::trunc);
+        if (!out.is_open())
+        {
+            return false;
+        }
+        WriteAligned8(out, &header, 1);
+        WriteAligned8(out, pData.faceComponentIDs, pData.faceCount);
+        WriteAligned8(out, congruencies.data(), congruencies.size());
+        WriteAligned8(out, pData.sharpEdges, pData.sharpEdgeCount * 6);
+        WriteAligned8(out, pData.sharpEdgeCosines, pData.sharpEdgeCount);
+        WriteAligned8(out, pData.surfaceFaceVertices, pData.faceCount * 3);
+        if (!out.good())
+        {
+            out.close();
+            remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+    // rename() does not replace an existing file on Windows, another process was faster then
+    if (rename(temporaryPath.c_str(), pFilePath.c_str()) != 0)
+    {
+        remove(temporaryPath.c_str());
+    }
+    return true;
+}
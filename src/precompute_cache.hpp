@@ -0,0 +1,79 @@
+#ifndef PRECOMPUTE_CACHE_H
+#define PRECOMPUTE_CACHE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "mapped_file.hpp"
+#include "trimesh.hpp"
+
+namespace bwabstraction
+{
+
+/**
+ * @brief The PrecomputeCache class stores the view-independent results of
+ * BWAbstraction::LoadModel() in a binary file, one file per mesh and congruentThreshold.
+ * The file is a fixed header followed by flat arrays in native byte order, each aligned to
+ * 8 bytes. It is mapped into memory and the arrays are used in place, like BinaryMesh does,
+ * so the object has to stay open as long as they are used. Files of another version, byte
+ * order, mesh or parameters are rejected, and the precompute runs again.
+ */
+class PrecomputeCache
+{
+
+public:
+
+    typedef struct _Data
+    {
+        int faceCount;
+        // 1-based component ID per face, the values of BWAbstraction::meshFPropComponentID
+        const unsigned int* faceComponentIDs;
+        int componentCount;
+        const std::vector<std::pair<int, int> >* congruencies;
+        int sharpEdgeCount;
+        const float* sharpEdges;
+        const float* sharpEdgeCosines;
+        // three vertex indices per face
+        const int* surfaceFaceVertices;
+    } Data;
+
+    PrecomputeCache();
+
+    bool Open(const std::string &pFilePath, TriMesh *pMesh, unsigned long long pMeshHash, float pCongruentThreshold);
+    bool IsOpen() const;
+
+    int FaceCount() const;
+    const unsigned int* FaceComponentIDs() const;
+    int ComponentCount() const;
+    void GetCongruencies(std::vector<std::pair<int, int> > &pCongruencies) const;
+    int SharpEdgeCount() const;
+    // two endpoints (xyz) per edge
+    const float* SharpEdges() const;
+    // one ascending cosine per edge
+    const float* SharpEdgeCosines() const;
+    // three vertex indices per face
+    const int* SurfaceFaceVertices() const;
+
+    static unsigned long long HashMesh(TriMesh *pMesh);
+    static std::string FilePath(const std::string &pDirectory, unsigned long long pMeshHash, float pCongruentThreshold);
+    static bool Save(const std::string &pFilePath, unsigned long long pMeshHash, float pCongruentThreshold, const Data &pData);
+
+private:
+
+    MappedFile file;
+    int faceCount;
+    int componentCount;
+    int congruencyCount;
+    int sharpEdgeCount;
+    const unsigned int* faceComponentIDs;
+    // two component indices per congruency
+    const int* congruencies;
+    const float* sharpEdges;
+    const float* sharpEdgeCosines;
+    const int* surfaceFaceVertices;
+
+};
+
+} // namespace bwabstraction
+
+#endif // PRECOMPUTE_CACHE_H
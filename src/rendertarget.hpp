@@ -3,12 +3,104 @@
 
 #include <GL/glew.h>
 #include <opencv2/opencv.hpp>
+#include <cstring>
+
+// texture readback through a pixel pack buffer, the copy runs on the GPU until end() is called
+typedef struct _AsyncReadback
+{
+    GLuint pbo;
+    GLsync fence;
+    GLsizeiptr size;
+    int w;
+    int h;
+    int bytesPerPixel;
+
+    void init()
+    {
+        glGenBuffers(1, &pbo);
+        fence = 0;
+        size = 0;
+    }
+
+    void begin(GLuint texture, GLenum format, GLenum type, int w, int h, int bytesPerPixel)
+    {
+        this->w = w;
+        this->h = h;
+        this->bytesPerPixel = bytesPerPixel;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        GLsizeiptr newSize = static_cast<GLsizeiptr>(w) * h * bytesPerPixel;
+        if (newSize != size)
+        {
+            glBufferData(GL_PIXEL_PACK_BUFFER, newSize, NULL, GL_STREAM_READ);
+            size = newSize;
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glGetTexImage(GL_TEXTURE_2D, 0, format, type, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        if (fence)
+        {
+            glDeleteSync(fence);
+        }
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    bool pending()
+    {
+        return fence != 0;
+    }
+
+    // wait for the copy and store it bottom-up in m (h x w, bytesPerPixel per element),
+    // so the image rows come out top to bottom without a separate flip.
+    // false if the buffer could not be mapped or its contents were lost, e.g. with the context.
+    bool end(cv::Mat &m)
+    {
+        GLenum status;
+        do
+        {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        } while (status == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fence);
+        fence = 0;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        const unsigned char* src = static_cast<const unsigned char*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT));
+        if (!src)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            return false;
+        }
+        size_t rowBytes = static_cast<size_t>(w) * bytesPerPixel;
+        for (int row = 0; row < h; ++row)
+        {
+            memcpy(m.ptr<unsigned char>(h - 1 - row), src + row * rowBytes, rowBytes);
+        }
+        const bool valid = glUnmapBuffer(GL_PIXEL_PACK_BUFFER) == GL_TRUE;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return valid;
+    }
+
+    void release()
+    {
+        if (fence)
+        {
+            glDeleteSync(fence);
+            fence = 0;
+        }
+        glDeleteBuffers(1, &pbo);
+    }
+
+} AsyncReadback;
 
 typedef struct _INT32DTarget
 {
     GLuint fbo;
     GLuint color_id_buffer;
     GLuint depth_buffer;
+    AsyncReadback colorReadback;
+    AsyncReadback depthReadback;
     int w;
     int h;
 
@@ -29,6 +121,9 @@ typedef struct _INT32DTarget
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
         glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_id_buffer, 0);
         glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_buffer, 0);
+
+        colorReadback.init();
+        depthReadback.init();
     }
 
     void resize(int w, int h)
@@ -50,24 +145,36 @@ typedef struct _INT32DTarget
         glViewport(0, 0, w, h);
     }
 
-    cv::Mat readback()
+    // queue the copy of the current contents, readback() / readbackDepth() pick it up later
+    void beginReadback()
     {
-        cv::Mat m = cv::Mat(h, w, CV_32SC1);
-        glBindTexture(GL_TEXTURE_2D, color_id_buffer);
-        glGetTexImage(GL_TEXTURE_2D, 0, GL_RED_INTEGER, GL_INT, m.data);
-        cv::Mat m2 = cv::Mat(h, w, CV_32SC1);
-        cv::flip(m, m2, 0);
-        return m2;
+        colorReadback.begin(color_id_buffer, GL_RED_INTEGER, GL_INT, w, h, 4);
     }
 
-    cv::Mat readbackDepth()
+    void beginReadbackDepth()
     {
-        cv::Mat m = cv::Mat(h, w, CV_32FC1);
-        glBindTexture(GL_TEXTURE_2D, depth_buffer);
-        glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_FLOAT, m.data);
-        cv::Mat m2 = cv::Mat(h, w, CV_32FC1);
-        cv::flip(m, m2, 0);
-        return m2;
+        depthReadback.begin(depth_buffer, GL_DEPTH_COMPONENT, GL_FLOAT, w, h, 4);
+    }
+
+    // m is reallocated only if its size or type differs, false if the readback failed
+    bool readback(cv::Mat &m)
+    {
+        if (!colorReadback.pending())
+        {
+            beginReadback();
+        }
+        m.create(h, w, CV_32SC1);
+        return colorReadback.end(m);
+    }
+
+    bool readbackDepth(cv::Mat &m)
+    {
+        if (!depthReadback.pending())
+        {
+            beginReadbackDepth();
+        }
+        m.create(h, w, CV_32FC1);
+        return depthReadback.end(m);
     }
 
     void update(cv::Mat m)
@@ -95,6 +202,8 @@ typedef struct _INT32DTarget
 
     void release()
     {
+        colorReadback.release();
+        depthReadback.release();
         glDeleteTextures(1, &color_id_buffer);
         glDeleteTextures(1, &depth_buffer);
         glDeleteFramebuffers(1, &fbo);
@@ -102,11 +211,128 @@ typedef struct _INT32DTarget
 
 } INT32DTarget;
 
+// triangle ID in color attachment 0, polygon-offset depth (R32F) in color attachment 1
+typedef struct _INT32R32FDTarget
+{
+    GLuint fbo;
+    GLuint color_id_buffer;
+    GLuint offset_depth_buffer;
+    GLuint depth_buffer;
+    AsyncReadback colorReadback;
+    AsyncReadback offsetDepthReadback;
+    int w;
+    int h;
+
+    void init()
+    {
+        glGenTextures(1, &color_id_buffer);
+        glBindTexture(GL_TEXTURE_2D, color_id_buffer);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenTextures(1, &offset_depth_buffer);
+        glBindTexture(GL_TEXTURE_2D, offset_depth_buffer);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenTextures(1, &depth_buffer);
+        glBindTexture(GL_TEXTURE_2D, depth_buffer);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_id_buffer, 0);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, offset_depth_buffer, 0);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_buffer, 0);
+
+        colorReadback.init();
+        offsetDepthReadback.init();
+    }
+
+    void resize(int w, int h)
+    {
+        this->w = w;
+        this->h = h;
+
+        glBindTexture(GL_TEXTURE_2D, color_id_buffer);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, w, h, 0, GL_RED_INTEGER, GL_INT, NULL);
+
+        glBindTexture(GL_TEXTURE_2D, offset_depth_buffer);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, NULL);
+
+        glBindTexture(GL_TEXTURE_2D, depth_buffer);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, w, h, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    }
+
+    void bind()
+    {
+        static const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
+        glDrawBuffers(2, drawBuffers);
+        glViewport(0, 0, w, h);
+    }
+
+    void beginReadback()
+    {
+        colorReadback.begin(color_id_buffer, GL_RED_INTEGER, GL_INT, w, h, 4);
+    }
+
+    void beginReadbackOffsetDepth()
+    {
+        offsetDepthReadback.begin(offset_depth_buffer, GL_RED, GL_FLOAT, w, h, 4);
+    }
+
+    bool readback(cv::Mat &m)
+    {
+        if (!colorReadback.pending())
+        {
+            beginReadback();
+        }
+        m.create(h, w, CV_32SC1);
+        return colorReadback.end(m);
+    }
+
+    bool readbackOffsetDepth(cv::Mat &m)
+    {
+        if (!offsetDepthReadback.pending())
+        {
+            beginReadbackOffsetDepth();
+        }
+        m.create(h, w, CV_32FC1);
+        return offsetDepthReadback.end(m);
+    }
+
+    // the offset depth is cleared to the far plane like a depth buffer
+    void bindClear(int val)
+    {
+        static const float farDepth = 1.0f;
+        bind();
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glClearBufferiv(GL_COLOR, 0, &val);
+        glClearBufferfv(GL_COLOR, 1, &farDepth);
+    }
+
+    void release()
+    {
+        colorReadback.release();
+        offsetDepthReadback.release();
+        glDeleteTextures(1, &color_id_buffer);
+        glDeleteTextures(1, &offset_depth_buffer);
+        glDeleteTextures(1, &depth_buffer);
+        glDeleteFramebuffers(1, &fbo);
+    }
+
+} INT32R32FDTarget;
+
 typedef struct _RGBADTarget
 {
     GLuint fbo;
     GLuint color_id_buffer;
     GLuint depth_buffer;
+    AsyncReadback colorReadback;
+    AsyncReadback depthReadback;
     int w;
     int h;
 
@@ -127,6 +353,9 @@ typedef struct _RGBADTarget
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo);
         glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_id_buffer, 0);
         glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_buffer, 0);
+
+        colorReadback.init();
+        depthReadback.init();
     }
 
     void resize(int w, int h)
@@ -148,24 +377,26 @@ typedef struct _RGBADTarget
         glViewport(0, 0, w, h);
     }
 
-    cv::Mat readback()
+    bool readback(cv::Mat &m)
     {
-        cv::Mat m = cv::Mat(h, w, CV_8UC4);
-        glBindTexture(GL_TEXTURE_2D, color_id_buffer);
-        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, m.data);
-        cv::Mat m2 = cv::Mat(h, w, CV_8UC4);
-        cv::flip(m, m2, 0);
-        return m2;
+        colorReadback.begin(color_id_buffer, GL_RGBA, GL_UNSIGNED_BYTE, w, h, 4);
+        m.create(h, w, CV_8UC4);
+        return colorReadback.end(m);
     }
 
-    cv::Mat readbackDepth()
+    // red channel only, converted by the driver instead of a mixChannels() on the CPU
+    bool readbackRed(cv::Mat &m)
     {
-        cv::Mat m = cv::Mat(h, w, CV_32FC1);
-        glBindTexture(GL_TEXTURE_2D, depth_buffer);
-        glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_FLOAT, m.data);
-        cv::Mat m2 = cv::Mat(h, w, CV_32FC1);
-        cv::flip(m, m2, 0);
-        return m2;
+        colorReadback.begin(color_id_buffer, GL_RED, GL_UNSIGNED_BYTE, w, h, 1);
+        m.create(h, w, CV_8UC1);
+        return colorReadback.end(m);
+    }
+
+    bool readbackDepth(cv::Mat &m)
+    {
+        depthReadback.begin(depth_buffer, GL_DEPTH_COMPONENT, GL_FLOAT, w, h, 4);
+        m.create(h, w, CV_32FC1);
+        return depthReadback.end(m);
     }
 
     void update(cv::Mat m)
@@ -192,6 +423,8 @@ typedef struct _RGBADTarget
 
     void release()
     {
+        colorReadback.release();
+        depthReadback.release();
         glDeleteTextures(1, &color_id_buffer);
         glDeleteTextures(1, &depth_buffer);
         glDeleteFramebuffers(1, &fbo);
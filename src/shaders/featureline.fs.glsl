@@ -2,7 +2,14 @@
 
 layout(location = 0) out int featureLineOut;
 
+uniform sampler2D offsetDepthMap;
+
 void main(void)
 {
+    // depth test against the offset depth written by triangleid.fs.glsl
+    if(gl_FragCoord.z >= texelFetch(offsetDepthMap, ivec2(gl_FragCoord.xy), 0).x)
+    {
+        discard;
+    }
     featureLineOut = 1;
 }
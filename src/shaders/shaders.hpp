@@ -58,14 +58,21 @@ const char* bake_hairline_cs_glsl =
 "}                                                                      \n";
 
 const char* featureline_fs_glsl = 
-"#version 410 core                            \n"
-"                                             \n"
-"layout(location = 0) out int featureLineOut; \n"
-"                                             \n"
-"void main(void)                              \n"
-"{                                            \n"
-"    featureLineOut = 1;                      \n"
-"}                                            \n";
+"#version 410 core                                                                 \n"
+"                                                                                  \n"
+"layout(location = 0) out int featureLineOut;                                      \n"
+"                                                                                  \n"
+"uniform sampler2D offsetDepthMap;                                                 \n"
+"                                                                                  \n"
+"void main(void)                                                                   \n"
+"{                                                                                 \n"
+"    // depth test against the offset depth written by triangleid.fs.glsl          \n"
+"    if(gl_FragCoord.z >= texelFetch(offsetDepthMap, ivec2(gl_FragCoord.xy), 0).x) \n"
+"    {                                                                             \n"
+"        discard;                                                                  \n"
+"    }                                                                             \n"
+"    featureLineOut = 1;                                                           \n"
+"}                                                                                 \n";
 
 const char* featureline_vs_glsl = 
 "#version 410 core                            \n"
@@ -80,14 +87,22 @@ const char* featureline_vs_glsl =
 "}                                            \n";
 
 const char* triangleid_fs_glsl = 
-"#version 410 core                            \n"
-"                                             \n"
-"layout(location = 0) out int primitiveIDOut; \n"
-"                                             \n"
-"void main(void)                              \n"
-"{                                            \n"
-"    primitiveIDOut = gl_PrimitiveID;         \n"
-"}                                            \n";
+"#version 410 core                                                                             \n"
+"                                                                                              \n"
+"layout(location = 0) out int primitiveIDOut;                                                  \n"
+"layout(location = 1) out float offsetDepthOut;                                                \n"
+"                                                                                              \n"
+"// glPolygonOffset(offsetFactor, units) with units already scaled by DEPTH_RESOLUTION         \n"
+"// (see software_rasterizer.hpp), used by featureline.fs.glsl instead of a second offset pass \n"
+"uniform float offsetFactor;                                                                   \n"
+"uniform float offsetUnits;                                                                    \n"
+"                                                                                              \n"
+"void main(void)                                                                               \n"
+"{                                                                                             \n"
+"    primitiveIDOut = gl_PrimitiveID;                                                          \n"
+"    float slope = max(abs(dFdx(gl_FragCoord.z)), abs(dFdy(gl_FragCoord.z)));                  \n"
+"    offsetDepthOut = clamp(gl_FragCoord.z + offsetFactor * slope + offsetUnits, 0.0, 1.0);    \n"
+"}                                                                                             \n";
 
 const char* triangleid_vs_glsl = 
 "#version 410 core                            \n"
@@ -1,8 +1,16 @@
 #version 410 core
 
 layout(location = 0) out int primitiveIDOut;
+layout(location = 1) out float offsetDepthOut;
+
+// glPolygonOffset(offsetFactor, units) with units already scaled by DEPTH_RESOLUTION
+// (see software_rasterizer.hpp), used by featureline.fs.glsl instead of a second offset pass
+uniform float offsetFactor;
+uniform float offsetUnits;
 
 void main(void)
 {
     primitiveIDOut = gl_PrimitiveID;
+    float slope = max(abs(dFdx(gl_FragCoord.z)), abs(dFdy(gl_FragCoord.z)));
+    offsetDepthOut = clamp(gl_FragCoord.z + offsetFactor * slope + offsetUnits, 0.0, 1.0);
 }
@@ -0,0 +1,471 @@
+#include "software_rasterizer.hpp"
+#include "threads.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+using namespace bwabstraction;
+using namespace std;
+using namespace cv;
+
+#define TILE_SIZE 64
+
+namespace
+{
+
+/**
+ * @brief ClipNear
+ * Clip a convex polygon in clip space against the near plane (z >= -w).
+ * @return Vertex count of the clipped polygon, at most count + 1.
+ */
+int ClipNear(const float in[][4], int count, float out[][4])
+{
+    int n = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        const float* p = in[i];
+        const float* q = in[(i + 1) % count];
+        float dp = p[2] + p[3];
+        float dq = q[2] + q[3];
+        if (dp >= 0.0f)
+        {
+            memcpy(out[n++], p, sizeof(float) * 4);
+        }
+        if ((dp >= 0.0f) != (dq >= 0.0f))
+        {
+            float t = dp / (dp - dq);
+            for (int k = 0; k < 4; ++k)
+            {
+                out[n][k] = p[k] + t * (q[k] - p[k]);
+            }
+            ++n;
+        }
+    }
+    return n;
+}
+
+// clip space to window coordinates, y pointing down to match the flipped readback
+void ToWindow(const float clip[4], int width, int height, double &x, double &y, double &z)
+{
+    double invW = 1.0 / clip[3];
+    x = (clip[0] * invW * 0.5 + 0.5) * width;
+    y = (0.5 - clip[1] * invW * 0.5) * height;
+    z = clip[2] * invW * 0.5 + 0.5;
+}
+
+} // namespace
+
+SoftwareRasterizer::SoftwareRasterizer() :
+    width(0),
+    height(0),
+    tilesX(0),
+    tilesY(0),
+    offsetFactor(0.0f),
+    offsetUnits(0.0f)
+{
+}
+
+void SoftwareRasterizer::SetViewport(int width, int height)
+{
+    this->width = width;
+    this->height = height;
+    tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+void SoftwareRasterizer::SetPolygonOffset(float factor, float units)
+{
+    offsetFactor = factor;
+    offsetUnits = units;
+}
+
+/**
+ * @brief SoftwareRasterizer::DrawTriangles
+ * Equivalent of the triangle ID pass with GL_LESS depth test, which also writes the
+ * polygon-offset depth of the visible triangle for the sharp edge depth test.
+ * @param mvp Column-major model view projection matrix.
+ * @param positions Vertex positions (xyz).
+ * @param indices Three vertex indices per triangle, the triangle index is the primitive ID.
+ * @param triangleIDMap Output CV_32SC1 map, -1 for background.
+ * @param depthMap Output CV_32FC1 window depth with polygon offset, 1 for background.
+ */
+void SoftwareRasterizer::DrawTriangles(const float mvp[16],
+                                       const vector<float> &positions,
+                                       const vector<unsigned int> &indices,
+                                       Mat &triangleIDMap,
+                                       Mat &depthMap)
+{
+    triangleIDMap.create(height, width, CV_32SC1);
+    triangleIDMap = Scalar(-1);
+    depthMap.create(height, width, CV_32FC1);
+    depthMap = Scalar(1.0f);
+    primitiveDepth.assign(width * height, 1.0f);
+
+    TransformVertices(mvp, positions.data(), static_cast<int>(positions.size() / 3));
+
+    // set up and bin contiguous ranges of triangles, one range per thread
+    int numTriangles = static_cast<int>(indices.size() / 3);
+    int chunks = MaxThreads();
+    ResetBins(chunks);
+    triangles.resize(chunks);
+    #pragma omp parallel for schedule(static, 1)
+    for (int chunk = 0; chunk < chunks; ++chunk)
+    {
+        vector<Triangle> &out = triangles[chunk];
+        out.clear();
+        int begin = static_cast<int>(static_cast<long long>(numTriangles) * chunk / chunks);
+        int end = static_cast<int>(static_cast<long long>(numTriangles) * (chunk + 1) / chunks);
+        for (int f = begin; f < end; ++f)
+        {
+            float clip[3][4];
+            for (int k = 0; k < 3; ++k)
+            {
+                memcpy(clip[k], &clipVertices[indices[f * 3 + k] * 4], sizeof(float) * 4);
+            }
+            size_t first = out.size();
+            SetupTriangle(clip, f, out);
+            for (size_t i = first; i < out.size(); ++i)
+            {
+                BinRect(chunk, static_cast<int>(i), out[i].minX, out[i].minY, out[i].maxX, out[i].maxY);
+            }
+        }
+    }
+
+    // each tile is owned by one thread and walks its triangles in primitive order,
+    // so ties are resolved like GL_LESS regardless of the thread count
+    int numTiles = tilesX * tilesY;
+    #pragma omp parallel for schedule(dynamic)
+    for (int tile = 0; tile < numTiles; ++tile)
+    {
+        int x0 = (tile % tilesX) * TILE_SIZE;
+        int y0 = (tile / tilesX) * TILE_SIZE;
+        int x1 = min(x0 + TILE_SIZE, width) - 1;
+        int y1 = min(y0 + TILE_SIZE, height) - 1;
+        for (int chunk = 0; chunk < chunks; ++chunk)
+        {
+            const vector<int> &bin = bins[chunk][tile];
+            for (size_t i = 0; i < bin.size(); ++i)
+            {
+                RasterizeTriangle(triangles[chunk][bin[i]], x0, y0, x1, y1, triangleIDMap, depthMap);
+            }
+        }
+    }
+}
+
+/**
+ * @brief SoftwareRasterizer::DrawLines
+ * Equivalent of drawing GL_LINES with GL_LESS depth test against depthMap.
+ * @param mvp Column-major model view projection matrix.
+ * @param lines Two endpoints (xyz) per line segment.
+ * @param numLines Number of segments drawn from the start of lines.
+ * @param depthMap Depth map from DrawTriangles().
+ * @param lineMap Output CV_32SC1 map, 1 for visible line pixels, -1 otherwise.
+ */
+void SoftwareRasterizer::DrawLines(const float mvp[16],
+                                   const float* lines,
+                                   int numLines,
+                                   const Mat &depthMap,
+                                   Mat &lineMap)
+{
+    lineMap.create(height, width, CV_32SC1);
+    lineMap = Scalar(-1);
+
+    TransformVertices(mvp, lines, numLines * 2);
+
+    int chunks = MaxThreads();
+    ResetBins(chunks);
+    this->lines.resize(chunks);
+    #pragma omp parallel for schedule(static, 1)
+    for (int chunk = 0; chunk < chunks; ++chunk)
+    {
+        vector<Line> &out = this->lines[chunk];
+        out.clear();
+        int begin = static_cast<int>(static_cast<long long>(numLines) * chunk / chunks);
+        int end = static_cast<int>(static_cast<long long>(numLines) * (chunk + 1) / chunks);
+        for (int i = begin; i < end; ++i)
+        {
+            float clip[2][4];
+            memcpy(clip[0], &clipVertices[i * 8], sizeof(float) * 4);
+            memcpy(clip[1], &clipVertices[i * 8 + 4], sizeof(float) * 4);
+            size_t first = out.size();
+            SetupLine(clip, out);
+            if (out.size() > first)
+            {
+                BinRect(chunk, static_cast<int>(first), out[first].minX, out[first].minY, out[first].maxX, out[first].maxY);
+            }
+        }
+    }
+
+    int numTiles = tilesX * tilesY;
+    #pragma omp parallel for schedule(dynamic)
+    for (int tile = 0; tile < numTiles; ++tile)
+    {
+        int x0 = (tile % tilesX) * TILE_SIZE;
+        int y0 = (tile / tilesX) * TILE_SIZE;
+        int x1 = min(x0 + TILE_SIZE, width) - 1;
+        int y1 = min(y0 + TILE_SIZE, height) - 1;
+        for (int chunk = 0; chunk < chunks; ++chunk)
+        {
+            const vector<int> &bin = bins[chunk][tile];
+            for (size_t i = 0; i < bin.size(); ++i)
+            {
+                RasterizeLine(this->lines[chunk][bin[i]], x0, y0, x1, y1, depthMap, lineMap);
+            }
+        }
+    }
+}
+
+void SoftwareRasterizer::TransformVertices(const float mvp[16], const float* positions, int numVertices)
+{
+    clipVertices.resize(numVertices * 4);
+    #pragma omp parallel for
+    for (int i = 0; i < numVertices; ++i)
+    {
+        const float* p = &positions[i * 3];
+        float* c = &clipVertices[i * 4];
+        for (int row = 0; row < 4; ++row)
+        {
+            c[row] = mvp[row] * p[0] + mvp[4 + row] * p[1] + mvp[8 + row] * p[2] + mvp[12 + row];
+        }
+    }
+}
+
+void SoftwareRasterizer::SetupTriangle(const float clip[][4], int id, vector<Triangle> &out)
+{
+    float polygon[4][4];
+    int n = ClipNear(clip, 3, polygon);
+    if (n < 3)
+    {
+        return;
+    }
+
+    double x[4], y[4], z[4];
+    for (int i = 0; i < n; ++i)
+    {
+        if (polygon[i][3] <= 0.0f)
+        {
+            return;
+        }
+        ToWindow(polygon[i], width, height, x[i], y[i], z[i]);
+    }
+
+    // a clipped quad becomes a fan of two triangles with the same primitive ID
+    for (int i = 1; i + 1 < n; ++i)
+    {
+        int v[3] = { 0, i, i + 1 };
+        double area = (x[v[1]] - x[v[0]]) * (y[v[2]] - y[v[0]]) - (y[v[1]] - y[v[0]]) * (x[v[2]] - x[v[0]]);
+        if (area == 0.0)
+        {
+            continue;
+        }
+        // no face culling, orient every triangle so that the inside is positive
+        if (area < 0.0)
+        {
+            swap(v[1], v[2]);
+            area = -area;
+        }
+
+        Triangle t;
+        t.id = id;
+        double minX = min(x[v[0]], min(x[v[1]], x[v[2]]));
+        double maxX = max(x[v[0]], max(x[v[1]], x[v[2]]));
+        double minY = min(y[v[0]], min(y[v[1]], y[v[2]]));
+        double maxY = max(y[v[0]], max(y[v[1]], y[v[2]]));
+        t.minX = static_cast<int>(max(floor(minX), 0.0));
+        t.minY = static_cast<int>(max(floor(minY), 0.0));
+        t.maxX = static_cast<int>(min(ceil(maxX), width - 1.0));
+        t.maxY = static_cast<int>(min(ceil(maxY), height - 1.0));
+        if (t.minX > t.maxX || t.minY > t.maxY)
+        {
+            continue;
+        }
+
+        for (int e = 0; e < 3; ++e)
+        {
+            int i0 = v[e];
+            int i1 = v[(e + 1) % 3];
+            double dx = x[i1] - x[i0];
+            double dy = y[i1] - y[i0];
+            t.a[e] = -dy;
+            t.b[e] = dx;
+            t.c[e] = dy * x[i0] - dx * y[i0];
+            // an edge shared by two triangles has opposite directions in both,
+            // so exactly one of them owns the pixels centered on it
+            t.topLeft[e] = dy > 0.0 || (dy == 0.0 && dx < 0.0);
+        }
+
+        double z10 = z[v[1]] - z[v[0]];
+        double z20 = z[v[2]] - z[v[0]];
+        t.za = (z10 * (y[v[2]] - y[v[0]]) - z20 * (y[v[1]] - y[v[0]])) / area;
+        t.zb = (z20 * (x[v[1]] - x[v[0]]) - z10 * (x[v[2]] - x[v[0]])) / area;
+        t.zc = z[v[0]] - t.za * x[v[0]] - t.zb * y[v[0]];
+
+        // glPolygonOffset: factor * max depth slope + units * r
+        t.offset = static_cast<float>(offsetFactor * max(fabs(t.za), fabs(t.zb)) + offsetUnits * DEPTH_RESOLUTION);
+
+        out.push_back(t);
+    }
+}
+
+void SoftwareRasterizer::SetupLine(const float clip[][4], vector<Line> &out)
+{
+    float p[2][4];
+    memcpy(p, clip, sizeof(p));
+    float d0 = p[0][2] + p[0][3];
+    float d1 = p[1][2] + p[1][3];
+    if (d0 < 0.0f && d1 < 0.0f)
+    {
+        return;
+    }
+    if (d0 < 0.0f || d1 < 0.0f)
+    {
+        int in = d0 < 0.0f ? 1 : 0;
+        float t = d0 / (d0 - d1);
+        for (int k = 0; k < 4; ++k)
+        {
+            p[1 - in][k] = clip[0][k] + t * (clip[1][k] - clip[0][k]);
+        }
+    }
+    if (p[0][3] <= 0.0f || p[1][3] <= 0.0f)
+    {
+        return;
+    }
+
+    Line l;
+    double minX = DBL_MAX, minY = DBL_MAX, maxX = -DBL_MAX, maxY = -DBL_MAX;
+    for (int i = 0; i < 2; ++i)
+    {
+        double x, y, z;
+        ToWindow(p[i], width, height, x, y, z);
+        l.x[i] = static_cast<float>(x);
+        l.y[i] = static_cast<float>(y);
+        l.z[i] = static_cast<float>(z);
+        minX = min(minX, x);
+        minY = min(minY, y);
+        maxX = max(maxX, x);
+        maxY = max(maxY, y);
+    }
+    if (l.x[0] == l.x[1] && l.y[0] == l.y[1])
+    {
+        return;
+    }
+    l.minX = static_cast<int>(max(floor(minX), 0.0));
+    l.minY = static_cast<int>(max(floor(minY), 0.0));
+    l.maxX = static_cast<int>(min(floor(maxX), width - 1.0));
+    l.maxY = static_cast<int>(min(floor(maxY), height - 1.0));
+    if (l.minX > l.maxX || l.minY > l.maxY)
+    {
+        return;
+    }
+    out.push_back(l);
+}
+
+void SoftwareRasterizer::ResetBins(int chunks)
+{
+    // keep the allocations of the previous frame
+    bins.resize(chunks);
+    for (int chunk = 0; chunk < chunks; ++chunk)
+    {
+        bins[chunk].resize(tilesX * tilesY);
+        for (size_t tile = 0; tile < bins[chunk].size(); ++tile)
+        {
+            bins[chunk][tile].clear();
+        }
+    }
+}
+
+void SoftwareRasterizer::BinRect(int chunk, int index, int minX, int minY, int maxX, int maxY)
+{
+    for (int ty = minY / TILE_SIZE; ty <= maxY / TILE_SIZE; ++ty)
+    {
+        for (int tx = minX / TILE_SIZE; tx <= maxX / TILE_SIZE; ++tx)
+        {
+            bins[chunk][ty * tilesX + tx].push_back(index);
+        }
+    }
+}
+
+void SoftwareRasterizer::RasterizeTriangle(const Triangle &t, int x0, int y0, int x1, int y1, Mat &triangleIDMap, Mat &depthMap)
+{
+    int xs = max(t.minX, x0);
+    int xe = min(t.maxX, x1);
+    int ys = max(t.minY, y0);
+    int ye = min(t.maxY, y1);
+    for (int py = ys; py <= ye; ++py)
+    {
+        // sample at pixel centers like OpenGL
+        double cy = py + 0.5;
+        int* idRow = triangleIDMap.ptr<int>(py);
+        float* depthRow = depthMap.ptr<float>(py);
+        float* primitiveDepthRow = &primitiveDepth[py * width];
+        for (int px = xs; px <= xe; ++px)
+        {
+            double cx = px + 0.5;
+            bool inside = true;
+            for (int e = 0; e < 3; ++e)
+            {
+                double v = t.a[e] * cx + t.b[e] * cy + t.c[e];
+                if (v < 0.0 || (v == 0.0 && !t.topLeft[e]))
+                {
+                    inside = false;
+                    break;
+                }
+            }
+            if (!inside)
+            {
+                continue;
+            }
+
+            // fragments outside the depth range are clipped by the far plane
+            float z = static_cast<float>(t.za * cx + t.zb * cy + t.zc);
+            if (z < 0.0f || z > 1.0f)
+            {
+                continue;
+            }
+            // like triangleid.fs.glsl, the offset depth belongs to the visible triangle
+            if (z < primitiveDepthRow[px])
+            {
+                primitiveDepthRow[px] = z;
+                idRow[px] = t.id;
+                depthRow[px] = min(max(z + t.offset, 0.0f), 1.0f);
+            }
+        }
+    }
+}
+
+void SoftwareRasterizer::RasterizeLine(const Line &l, int x0, int y0, int x1, int y1, const Mat &depthMap, Mat &lineMap)
+{
+    double dx = l.x[1] - l.x[0];
+    double dy = l.y[1] - l.y[0];
+    double dz = l.z[1] - l.z[0];
+    bool xMajor = fabs(dx) >= fabs(dy);
+
+    // one fragment per pixel center along the major axis in [start, end),
+    // which leaves out the last pixel like the diamond-exit rule
+    double start = xMajor ? min(l.x[0], l.x[1]) : min(l.y[0], l.y[1]);
+    double end = xMajor ? max(l.x[0], l.x[1]) : max(l.y[0], l.y[1]);
+    int lo = static_cast<int>(max(ceil(start - 0.5), static_cast<double>(xMajor ? x0 : y0)));
+    int hi = static_cast<int>(min(ceil(end - 0.5) - 1.0, static_cast<double>(xMajor ? x1 : y1)));
+    for (int i = lo; i <= hi; ++i)
+    {
+        double c = i + 0.5;
+        double t = xMajor ? (c - l.x[0]) / dx : (c - l.y[0]) / dy;
+        double minor = xMajor ? l.y[0] + t * dy : l.x[0] + t * dx;
+        if (minor < (xMajor ? y0 : x0) || minor >= (xMajor ? y1 : x1) + 1)
+        {
+            continue;
+        }
+        int px = xMajor ? i : static_cast<int>(floor(minor));
+        int py = xMajor ? static_cast<int>(floor(minor)) : i;
+        float z = static_cast<float>(l.z[0] + t * dz);
+        if (z < 0.0f || z > 1.0f)
+        {
+            continue;
+        }
+        if (z < depthMap.at<float>(py, px))
+        {
+            lineMap.at<int>(py, px) = 1;
+        }
+    }
+}
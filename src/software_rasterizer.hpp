@@ -0,0 +1,96 @@
+#ifndef SOFTWARE_RASTERIZER_H
+#define SOFTWARE_RASTERIZER_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+// depth difference of one unit of the constant polygon offset term, shared with
+// triangleid.fs.glsl. OpenGL leaves it to the depth format, the offset depth is written to a
+// float attachment though, so the depth buffer does not matter. This is the resolution of a
+// 24-bit depth buffer, which the two-pass glPolygonOffset(5, 5) effectively used: a
+// GL_DEPTH_COMPONENT32 target is 24-bit on most drivers, and 2^-32 would be below the float
+// precision of the depth.
+#define DEPTH_RESOLUTION (1.0f / 16777216.0f)
+
+namespace bwabstraction
+{
+
+/**
+ * @brief The SoftwareRasterizer class is a CPU replacement for the two OpenGL passes of
+ * BWAbstraction (triangleid.*.glsl and featureline.*.glsl). It produces the same maps as the
+ * GL readback: triangle IDs (gl_PrimitiveID, -1 for background), the polygon-offset window
+ * depth of the visible triangle, and the depth tested sharp edge lines (1 for visible, -1
+ * otherwise). Rows are stored top to bottom like the readbacks of rendertarget.hpp.
+ *
+ * Primitives are binned into screen tiles in submission order and the tiles are rasterized
+ * in parallel with OpenMP, so the result does not depend on the number of threads.
+ */
+class SoftwareRasterizer
+{
+
+public:
+
+    SoftwareRasterizer();
+
+    void SetViewport(int width, int height);
+    // same semantics as glPolygonOffset(), applied to the depth map of DrawTriangles()
+    void SetPolygonOffset(float factor, float units);
+
+    void DrawTriangles(const float mvp[16],
+                       const std::vector<float> &positions,
+                       const std::vector<unsigned int> &indices,
+                       cv::Mat &triangleIDMap,
+                       cv::Mat &depthMap);
+    void DrawLines(const float mvp[16],
+                   const float* lines,
+                   int numLines,
+                   const cv::Mat &depthMap,
+                   cv::Mat &lineMap);
+
+private:
+
+    typedef struct _Triangle
+    {
+        int id;
+        int minX, minY, maxX, maxY;
+        // edge functions e = a * x + b * y + c, inside where e > 0 (or e == 0 on top-left edges)
+        double a[3], b[3], c[3];
+        bool topLeft[3];
+        // window depth plane z = za * x + zb * y + zc
+        double za, zb, zc;
+        float offset;
+    } Triangle;
+
+    typedef struct _Line
+    {
+        float x[2], y[2], z[2];
+        int minX, minY, maxX, maxY;
+    } Line;
+
+    void TransformVertices(const float mvp[16], const float* positions, int numVertices);
+    void SetupTriangle(const float clip[][4], int id, std::vector<Triangle> &out);
+    void SetupLine(const float clip[][4], std::vector<Line> &out);
+    void ResetBins(int chunks);
+    void BinRect(int chunk, int index, int minX, int minY, int maxX, int maxY);
+    void RasterizeTriangle(const Triangle &t, int x0, int y0, int x1, int y1, cv::Mat &triangleIDMap, cv::Mat &depthMap);
+    void RasterizeLine(const Line &l, int x0, int y0, int x1, int y1, const cv::Mat &depthMap, cv::Mat &lineMap);
+
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    float offsetFactor;
+    float offsetUnits;
+
+    std::vector<float> clipVertices;
+    std::vector<float> primitiveDepth;
+    std::vector<std::vector<Triangle> > triangles;
+    std::vector<std::vector<Line> > lines;
+    // bins[chunk][tile] lists primitive indices of triangles[chunk] or lines[chunk]
+    std::vector<std::vector<std::vector<int> > > bins;
+
+};
+
+} // namespace bwabstraction
+
+#endif // SOFTWARE_RASTERIZER_H
@@ -32,6 +32,8 @@ public:
                     std::vector<float> &texcoords,
                     std::vector<float> &colors,
                     std::vector<unsigned int> &indices);
+    /// Positions only (xyz per vertex), e.g. for lines that are drawn without indices.
+    void BufferData(const float* positions, GLsizei numVertices);
     void Color3f(float r, float g, float b);
     inline GLsizei VertexCount() { return vertexCount; }
     inline GLsizei IndexCount() { return indexCount; }
@@ -57,6 +59,8 @@ public:
     void Destroy();
     void Bind();
     void Draw(GLenum mode, StandardVertexAttribute &attribute);
+    // draw count vertices from first, for attributes without indices
+    void Draw(GLenum mode, StandardVertexAttribute &attribute, GLint first, GLsizei count);
 
     GLuint program;
 
@@ -207,6 +211,29 @@ void StandardVertexAttribute::BufferData(std::vector<float> &positions,
     }
 }
 
+void StandardVertexAttribute::BufferData(const float* positions, GLsizei numVertices)
+{
+    glBindVertexArray(vao);
+
+    vertexCount = numVertices;
+    indexCount = 0;
+
+    if(numVertices != 0)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[ATTRIB_POSITION]);
+        glBufferData(GL_ARRAY_BUFFER, numVertices * 3 * sizeof(float), positions, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(ATTRIB_POSITION);
+    }
+    else
+    {
+        glDisableVertexAttribArray(ATTRIB_POSITION);
+    }
+    glDisableVertexAttribArray(ATTRIB_NORMAL);
+    glDisableVertexAttribArray(ATTRIB_TEXCOORD);
+    glDisableVertexAttribArray(ATTRIB_COLOR);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
 void StandardVertexAttribute::Color3f(float r, float g, float b)
 {
     glBindVertexArray(vao);
@@ -333,4 +360,15 @@ void StandardShader::Draw(GLenum mode, StandardVertexAttribute &attribute)
     }
 }
 
+void StandardShader::Draw(GLenum mode, StandardVertexAttribute &attribute, GLint first, GLsizei count)
+{
+    Bind();
+    attribute.Bind();
+
+    if(count != 0)
+    {
+        glDrawArrays(mode, first, count);
+    }
+}
+
 #endif // STANDARDSHADER_IMPLEMENT
@@ -0,0 +1,206 @@
+#include "surface_labeling.hpp"
+#include "threads.hpp"
+#include <algorithm>
+
+using namespace bwabstraction;
+using namespace std;
+
+// rows per band of the parallel labeling
+#define LABELING_BAND_HEIGHT 32
+
+/**
+ * @brief SurfaceLabeling::SurfaceConnected
+ * Do the two faces share a vertex? (see BWAbstraction::ComputeSurfaceConnect())
+ */
+bool SurfaceLabeling::SurfaceConnected(const int* pFaceVertices, int pFace0, int pFace1)
+{
+    const int* a = &pFaceVertices[pFace0 * 3];
+    const int* b = &pFaceVertices[pFace1 * 3];
+    // no early outs, the comparisons are cheaper than the branches
+    return ((a[0] == b[0]) | (a[0] == b[1]) | (a[0] == b[2]) |
+            (a[1] == b[0]) | (a[1] == b[1]) | (a[1] == b[2]) |
+            (a[2] == b[0]) | (a[2] == b[1]) | (a[2] == b[2])) != 0;
+}
+
+/**
+ * @brief SurfaceLabeling::Label
+ * The rows are split into bands that are labelled in parallel with a union-find, then the
+ * bands are merged along their borders with lock-free unions. The depth critical pixels inside
+ * a patch depend on the order of the flood fill, so it is replayed for the few patches that
+ * have such pixels.
+ */
+void SurfaceLabeling::Label(const int* pTriangleIDs, int pWidth, int pHeight, const int* pFaceVertices,
+                            vector<int> &pPixelRoots, char* pDepthCritLines)
+{
+    static const int neighbors[] =
+    {
+        -1, 0,
+        1, 0,
+        0, -1,
+        0, 1
+    };
+
+    const int width = pWidth;
+    const int height = pHeight;
+    const int pixelCount = width * height;
+    const int* triangleIDs = pTriangleIDs;
+    char* depthCritLines = pDepthCritLines;
+    vector<int> &pixelRoots = pPixelRoots;
+
+    pixelSets.Reset(pixelCount);
+    pixelRoots.resize(pixelCount);
+
+    // union with the left and upper neighbours, every band only touches its own pixels
+    const int bands = (height + LABELING_BAND_HEIGHT - 1) / LABELING_BAND_HEIGHT;
+    #pragma omp parallel for schedule(dynamic)
+    for(int band = 0; band < bands; ++band)
+    {
+        int rowBegin = band * LABELING_BAND_HEIGHT;
+        int rowEnd = min(height, rowBegin + LABELING_BAND_HEIGHT);
+        for(int row = rowBegin; row < rowEnd; ++row)
+        {
+            for(int col = 0; col < width; ++col)
+            {
+                int pixel = row * width + col;
+                int id = triangleIDs[pixel];
+                if(id == -1)
+                {
+                    continue;
+                }
+                if(col > 0 && triangleIDs[pixel - 1] != -1 && SurfaceConnected(pFaceVertices, id, triangleIDs[pixel - 1]))
+                {
+                    pixelSets.UniteExclusive(pixel, pixel - 1);
+                }
+                if(row > rowBegin && triangleIDs[pixel - width] != -1 && SurfaceConnected(pFaceVertices, id, triangleIDs[pixel - width]))
+                {
+                    pixelSets.UniteExclusive(pixel, pixel - width);
+                }
+            }
+        }
+    }
+
+    // merge the bands along their upper borders, the same sets can be reached from several borders
+    #pragma omp parallel for schedule(dynamic)
+    for(int band = 1; band < bands; ++band)
+    {
+        int row = band * LABELING_BAND_HEIGHT;
+        for(int col = 0; col < width; ++col)
+        {
+            int pixel = row * width + col;
+            int id = triangleIDs[pixel];
+            if(id != -1 && triangleIDs[pixel - width] != -1 && SurfaceConnected(pFaceVertices, id, triangleIDs[pixel - width]))
+            {
+                pixelSets.Unite(pixel, pixel - width);
+            }
+        }
+    }
+
+    #pragma omp parallel for
+    for(int pixel = 0; pixel < pixelCount; ++pixel)
+    {
+        pixelRoots[pixel] = triangleIDs[pixel] == -1 ? -1 : pixelSets.Find(pixel);
+    }
+
+    // depth critical: a pixel next to a pixel of an unconnected face. the flood fill marked the
+    // pixel of the earlier patch, so do we. inside a patch it marked the pixel it dequeued while
+    // the other one was not queued yet, which is left to the replay below.
+    vector<vector<int> > threadFoldedRoots(MaxThreads());
+    #pragma omp parallel for
+    for(int row = 0; row < height; ++row)
+    {
+        vector<int> &roots = threadFoldedRoots[ThreadNum()];
+        for(int col = 0; col < width; ++col)
+        {
+            int pixel = row * width + col;
+            int id = triangleIDs[pixel];
+            if(id == -1)
+            {
+                continue;
+            }
+            for(int n = 0; n < 4; ++n)
+            {
+                int nrow = row + neighbors[2 * n];
+                int ncol = col + neighbors[2 * n + 1];
+                if(nrow < 0 || ncol < 0 || nrow >= height || ncol >= width)
+                {
+                    continue;
+                }
+                int npixel = nrow * width + ncol;
+                int id2 = triangleIDs[npixel];
+                if(id2 == -1 || SurfaceConnected(pFaceVertices, id, id2))
+                {
+                    continue;
+                }
+                int root = pixelRoots[pixel];
+                int root2 = pixelRoots[npixel];
+                if(root2 > root)
+                {
+                    depthCritLines[pixel] = 1;
+                }
+                else if(root2 == root && npixel > pixel && (roots.empty() || roots.back() != root))
+                {
+                    roots.push_back(root);
+                }
+            }
+        }
+    }
+
+    // replay the flood fill from the roots of the patches on folded or self-adjacent surfaces. the
+    // patches are disjoint, so they are replayed in parallel.
+    foldedRoots.clear();
+    for(auto it = threadFoldedRoots.begin(); it != threadFoldedRoots.end(); ++it)
+    {
+        foldedRoots.insert(foldedRoots.end(), it->begin(), it->end());
+    }
+    sort(foldedRoots.begin(), foldedRoots.end());
+    foldedRoots.erase(unique(foldedRoots.begin(), foldedRoots.end()), foldedRoots.end());
+    pixelQueued.resize(pixelCount, 0);
+    const int numFoldedRoots = static_cast<int>(foldedRoots.size());
+    #pragma omp parallel
+    {
+        vector<int> pixelQueue;
+        #pragma omp for schedule(dynamic)
+        for(int i = 0; i < numFoldedRoots; ++i)
+        {
+            const int root = foldedRoots[i];
+            pixelQueue.clear();
+            pixelQueue.push_back(root);
+            pixelQueued[root] = 1;
+            for(size_t head = 0; head < pixelQueue.size(); ++head)
+            {
+                int pixel = pixelQueue[head];
+                int row = pixel / width;
+                int col = pixel % width;
+                int id = triangleIDs[pixel];
+                for(int n = 0; n < 4; ++n)
+                {
+                    int nrow = row + neighbors[2 * n];
+                    int ncol = col + neighbors[2 * n + 1];
+                    if(nrow < 0 || ncol < 0 || nrow >= height || ncol >= width)
+                    {
+                        continue;
+                    }
+                    int npixel = nrow * width + ncol;
+                    if(pixelRoots[npixel] != root || pixelQueued[npixel])
+                    {
+                        continue;
+                    }
+                    if(SurfaceConnected(pFaceVertices, id, triangleIDs[npixel]))
+                    {
+                        pixelQueue.push_back(npixel);
+                        pixelQueued[npixel] = 1;
+                    }
+                    else
+                    {
+                        depthCritLines[pixel] = 1;
+                    }
+                }
+            }
+            for(auto it = pixelQueue.begin(); it != pixelQueue.end(); ++it)
+            {
+                pixelQueued[*it] = 0;
+            }
+        }
+    }
+
+}
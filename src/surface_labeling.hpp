@@ -0,0 +1,41 @@
+#ifndef SURFACE_LABELING_H
+#define SURFACE_LABELING_H
+
+#include <vector>
+#include "unionfind.hpp"
+
+namespace bwabstraction
+{
+
+/**
+ * @brief The SurfaceLabeling class splits a triangle ID map into patches of 4-connected pixels
+ * whose faces are connected on the surface, i.e. share a vertex. It gives the same patches and
+ * the same depth critical pixels as the sequential flood fill seeded in scan order that it
+ * replaces, tools/labeling_compare.cpp checks both against each other.
+ */
+class SurfaceLabeling
+{
+
+public:
+
+    // pTriangleIDs holds pWidth * pHeight face indices in scan order, -1 for background, and
+    // pFaceVertices three vertex indices per face. pPixelRoots receives the root of every pixel,
+    // the first pixel of its patch in scan order, or -1 for background. Depth critical pixels,
+    // next to a pixel of an unconnected face, are set to 1 in pDepthCritLines.
+    void Label(const int* pTriangleIDs, int pWidth, int pHeight, const int* pFaceVertices,
+               std::vector<int> &pPixelRoots, char* pDepthCritLines);
+
+    static bool SurfaceConnected(const int* pFaceVertices, int pFace0, int pFace1);
+
+private:
+
+    UnionFind pixelSets;
+    std::vector<int> foldedRoots;
+    // all 0 between calls
+    std::vector<char> pixelQueued;
+
+};
+
+} // namespace bwabstraction
+
+#endif // SURFACE_LABELING_H
@@ -0,0 +1,78 @@
+#ifndef THREADS_H
+#define THREADS_H
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace bwabstraction
+{
+
+// the OpenMP thread queries, with one thread when the library is built without OpenMP
+
+// number of threads of the next parallel region
+inline int MaxThreads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// set the number of threads of the next parallel regions of the calling thread, 0 keeps it.
+// returns the number to hand to RestoreMaxThreads(), 0 if nothing changed.
+inline int OverrideMaxThreads(int pNumThreads)
+{
+#ifdef _OPENMP
+    if (pNumThreads > 0)
+    {
+        int previous = omp_get_max_threads();
+        omp_set_num_threads(pNumThreads);
+        return previous;
+    }
+#endif
+    return 0;
+}
+
+inline void RestoreMaxThreads(int pPrevious)
+{
+#ifdef _OPENMP
+    if (pPrevious > 0)
+    {
+        omp_set_num_threads(pPrevious);
+    }
+#endif
+}
+
+// overrides the number of threads of the calling thread until the end of the scope
+class ScopedMaxThreads
+{
+
+public:
+
+    explicit ScopedMaxThreads(int pNumThreads) : previous(OverrideMaxThreads(pNumThreads)) {}
+    ~ScopedMaxThreads() { RestoreMaxThreads(previous); }
+
+    ScopedMaxThreads(const ScopedMaxThreads&) = delete;
+    ScopedMaxThreads& operator=(const ScopedMaxThreads&) = delete;
+
+private:
+
+    int previous;
+
+};
+
+// index of the calling thread in the current parallel region
+inline int ThreadNum()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+} // namespace bwabstraction
+
+#endif // THREADS_H
@@ -18,7 +18,7 @@
 
 #ifdef _MSC_VER
 #include <Windows.h>
-#elif __APPLE__
+#elif defined(__APPLE__) || defined(__linux__)
 #include <sys/time.h>
 #endif
 
@@ -41,7 +41,7 @@ private:
 #ifdef _MSC_VER
 	float frequency;
 	__int64 lastUpdate;
-#elif __APPLE__
+#elif defined(__APPLE__) || defined(__linux__)
 	long lastUpdate;
 #else
 	no_timer_implementation_available_in_this_environment
@@ -68,7 +68,7 @@ void Timer::Start(long initMktime)
 	frequency = float(f.QuadPart) / 1000.0f;
 	QueryPerformanceCounter(&f);
 	lastUpdate = f.QuadPart;
-#elif __APPLE__
+#elif defined(__APPLE__) || defined(__linux__)
 	timeval time;
 	gettimeofday(&time, NULL);
 	lastUpdate = time.tv_sec * 1000 + time.tv_usec / 1000;
@@ -84,7 +84,7 @@ void Timer::Update(void)
 	totalMktime += long(deltaTime);
 	deltaTime /= 1000.0f;
 	lastUpdate = t.QuadPart;
-#elif __APPLE__
+#elif defined(__APPLE__) || defined(__linux__)
 	timeval time;
 	gettimeofday(&time, NULL);
 	long current = time.tv_sec * 1000 + time.tv_usec / 1000;
@@ -1,4 +1,6 @@
 #include "trimesh.hpp"
+#include "obj_reader.hpp"
+#include "binary_mesh.hpp"
 #include <CGAL/convex_hull_2.h>
 #include <CGAL/min_quadrilateral_2.h>
 #include <CGAL/Polyhedron_3.h>
@@ -16,21 +18,129 @@
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <fstream>
 #include <sstream>
+#include <mutex>
 
 using namespace bwabstraction;
 using namespace std;
 using namespace OpenMesh;
 using namespace Eigen;
 
+// the OpenMesh IOManager and its reader modules are singletons with per-read state
+static std::mutex readMeshMutex;
+
 bool TriMesh::LoadOBJ(string file)
 {
-    if (!OpenMesh::IO::read_mesh(*this, file))
+    ObjReader::Data data;
+    if (!ObjReader::Read(file, data) || data.positions.empty())
     {
         std::cerr << "read error\n";
         return false;
     }
-    Normalize();
-    update_normals();
+
+    clear();
+    const int numVertices = static_cast<int>(data.positions.size() / 3);
+    const int numFaces = static_cast<int>(data.faceStart.size()) - 1;
+    reserve(numVertices, numFaces * 3 / 2 + numVertices, numFaces);
+
+    // normalize the model into (-1, -1, -1) ~ (1, 1, 1) as Normalize() does,
+    // with the bounds found while parsing.
+    double scale = 2.0 / max(max(static_cast<double>(data.maxCorner[0]) - data.minCorner[0],
+                                 static_cast<double>(data.maxCorner[1]) - data.minCorner[1]),
+                                 static_cast<double>(data.maxCorner[2]) - data.minCorner[2]);
+    double trans[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        trans[i] = (static_cast<double>(data.maxCorner[i]) + data.minCorner[i]) / -2.0;
+    }
+    for (int v = 0; v < numVertices; ++v)
+    {
+        const float* p = &data.positions[v * 3];
+        add_vertex(Point((p[0] + trans[0]) * scale, (p[1] + trans[1]) * scale, (p[2] + trans[2]) * scale));
+    }
+
+    // same rules as the OpenMesh importer: skip faces that use a vertex twice and
+    // give non-manifold faces their own copies of the vertices.
+    vector<VertexHandle> faceVertices;
+    for (int f = 0; f < numFaces; ++f)
+    {
+        faceVertices.clear();
+        for (int i = data.faceStart[f]; i < data.faceStart[f + 1]; ++i)
+        {
+            faceVertices.push_back(VertexHandle(data.faceIndices[i]));
+        }
+        bool degenerate = false;
+        for (size_t i = 0; i < faceVertices.size() && !degenerate; ++i)
+        {
+            for (size_t j = i + 1; j < faceVertices.size(); ++j)
+            {
+                if (faceVertices[i] == faceVertices[j])
+                {
+                    degenerate = true;
+                    break;
+                }
+            }
+        }
+        if (degenerate)
+        {
+            continue;
+        }
+        if (!add_face(faceVertices).is_valid())
+        {
+            for (size_t i = 0; i < faceVertices.size(); ++i)
+            {
+                faceVertices[i] = add_vertex(Point(point(faceVertices[i])));
+            }
+            add_face(faceVertices);
+        }
+    }
+
+    // the faces are only read here, so their normals can be computed side by side
+    const int numMeshFaces = static_cast<int>(n_faces());
+    #pragma omp parallel for
+    for (int f = 0; f < numMeshFaces; ++f)
+    {
+        FaceHandle fh(f);
+        set_normal(fh, calc_face_normal(fh));
+    }
+    update_vertex_normals();
+    return true;
+}
+
+bool TriMesh::LoadBWM(const BinaryMesh &file)
+{
+    if (!file.IsOpen())
+    {
+        return false;
+    }
+
+    // the positions are normalized and the faces were valid when the file was written
+    clear();
+    const int numVertices = file.VertexCount();
+    const int numFaces = file.FaceCount();
+    reserve(numVertices, numFaces * 3 / 2 + numVertices, numFaces);
+    const float* positions = file.Positions();
+    for (int v = 0; v < numVertices; ++v)
+    {
+        add_vertex(Point(positions[v * 3], positions[v * 3 + 1], positions[v * 3 + 2]));
+    }
+    const unsigned int* indices = file.Indices();
+    for (int f = 0; f < numFaces; ++f)
+    {
+        const unsigned int* face = &indices[f * 3];
+        if (!add_face(VertexHandle(face[0]), VertexHandle(face[1]), VertexHandle(face[2])).is_valid())
+        {
+            clear();
+            return false;
+        }
+    }
+
+    const float* normals = file.FaceNormals();
+    #pragma omp parallel for
+    for (int f = 0; f < numFaces; ++f)
+    {
+        set_normal(FaceHandle(f), Normal(normals[f * 3], normals[f * 3 + 1], normals[f * 3 + 2]));
+    }
+    update_vertex_normals();
     return true;
 }
 
@@ -42,7 +152,10 @@ bool TriMesh::LoadOM(string file)
     options += OpenMesh::IO::Options::VertexNormal;
     options += OpenMesh::IO::Options::FaceNormal;
 
-    if (!OpenMesh::IO::read_mesh(*this, file, options))
+    std::unique_lock<std::mutex> lock(readMeshMutex);
+    bool ok = OpenMesh::IO::read_mesh(*this, file, options);
+    lock.unlock();
+    if (!ok)
     {
         printf("LoadOM() failed.\n");
         return false;
@@ -105,11 +218,11 @@ void TriMesh::Normalize()
 {
     // normalize the model into (-1, -1, -1) ~ (1, 1, 1).
     double min_x = DBL_MAX;
-    double max_x = DBL_MIN;
+    double max_x = -DBL_MAX;
     double min_y = DBL_MAX;
-    double max_y = DBL_MIN;
+    double max_y = -DBL_MAX;
     double min_z = DBL_MAX;
-    double max_z = DBL_MIN;
+    double max_z = -DBL_MAX;
 
     // for each vertices, find minimum and maximum on each axis.
     for(VertexIter vit = vertices_begin(); vit != vertices_end(); ++vit) {
@@ -221,27 +334,39 @@ template<class Key, class Value> bool PairSmaller(const pair<Key, Value>& elem1,
 
 void TriMesh::BuildOBB()
 {
-    BuildOBBPCA();
-    Point size = obb.max - obb.min;
+    vector<Point> points;
+    points.reserve(n_vertices());
+    for(VertexIter vit = vertices_begin(); vit != vertices_end(); ++vit)
+    {
+        points.push_back(point(*vit));
+    }
+    obb.Build(points);
+}
+
+/**
+ * @brief TriMesh::OBB::Build
+ * Fit the box to a point set, by PCA first, then refined with rotating calipers.
+ */
+void TriMesh::OBB::Build(const vector<Point> &points)
+{
+    BuildPCA(points);
+    Point size = max - min;
     if(size[0] == 0 || size[1] == 0 || size[2] == 0)
     {
         return;
     }
     for(int i = 0; i < 3; ++i)
     {
-        BuildOBBRotatingCalipers();
+        BuildRotatingCalipers(points);
     }
 }
 
-void TriMesh::BuildOBBPCA()
+void TriMesh::OBB::BuildPCA(const vector<Point> &points)
 {
-    vector<Point> points;
     Point center(0, 0, 0);
-    for(VertexIter vit = vertices_begin(); vit != vertices_end(); ++vit)
+    for(unsigned int i = 0; i < points.size(); ++i)
     {
-        Point v = point(*vit);
-        points.push_back(v);
-        center += v;
+        center += points[i];
     }
     center /= points.size();
 
@@ -280,17 +405,17 @@ void TriMesh::BuildOBBPCA()
     iMid = eigenValueList[1].first;
     iMin = eigenValueList[2].first;
 
-    obb.origin = center;
-    obb.maxAxis = Vec3d( eigenvector( 0, iMax ), eigenvector( 1, iMax ), eigenvector( 2, iMax ) );
-    obb.midAxis = Vec3d( eigenvector( 0, iMid ), eigenvector( 1, iMid ), eigenvector( 2, iMid ) );
-    obb.minAxis = cross(obb.maxAxis, obb.midAxis);
-    obb.max = Vec3d(-DBL_MAX, -DBL_MAX, -DBL_MAX);
-    obb.min = Vec3d(DBL_MAX, DBL_MAX, DBL_MAX);
+    origin = center;
+    maxAxis = Vec3d( eigenvector( 0, iMax ), eigenvector( 1, iMax ), eigenvector( 2, iMax ) );
+    midAxis = Vec3d( eigenvector( 0, iMid ), eigenvector( 1, iMid ), eigenvector( 2, iMid ) );
+    minAxis = cross(maxAxis, midAxis);
+    max = Vec3d(-DBL_MAX, -DBL_MAX, -DBL_MAX);
+    min = Vec3d(DBL_MAX, DBL_MAX, DBL_MAX);
     for(unsigned int i = 0; i < points.size(); ++i)
     {
-        obb.Insert_A_Point(points[i]);
+        Insert_A_Point(points[i]);
     }
-    obb.MoveOriginToMiddilePoint();
+    MoveOriginToMiddilePoint();
 }
 
 void minRectangle( const vector<Vec2d>& points, vector<Vec2d>& rect )
@@ -332,20 +457,20 @@ void sortTripleSmaller( const Vec3d& v, Vec3i& vi )
     }
 }
 
-void TriMesh::BuildOBBRotatingCalipers()
+void TriMesh::OBB::BuildRotatingCalipers(const vector<Point> &points)
 {
     // find the side with maximal error w.r.t the minimal bounding rectangle from rotating calipers, recompute
 
     Point dir[3];
-    dir[0] = obb.maxAxis;
-    dir[1] = obb.midAxis;
-    dir[2] = obb.minAxis;
+    dir[0] = maxAxis;
+    dir[1] = midAxis;
+    dir[2] = minAxis;
 
     double side[3];
     double minSide = 1e30;
     int minSideIndex;
     for( int i=0; i<3; i++ ) {
-        side[i] = obb.max[i] - obb.min[i];
+        side[i] = max[i] - min[i];
         if( minSide>side[i] ) {
             minSide = side[i];
             minSideIndex = i;
@@ -355,11 +480,11 @@ void TriMesh::BuildOBBRotatingCalipers()
     if( minSide<1e-3 ) {
 
         vector<Vec2d> projPts;
-        for( VertexIter vit=vertices_begin(); vit!=vertices_end(); ++vit ) {
-            Vec3d v = point(*vit );
+        for( unsigned int k=0; k<points.size(); k++ ) {
+            Vec3d v = points[k];
             Vec2d projV;
-            projV[0] = (v-obb.origin) | dir[(minSideIndex+1)%3];
-            projV[1] = (v-obb.origin) | dir[(minSideIndex+2)%3];
+            projV[0] = (v-origin) | dir[(minSideIndex+1)%3];
+            projV[1] = (v-origin) | dir[(minSideIndex+2)%3];
             projPts.push_back( projV );
         }
 
@@ -374,33 +499,33 @@ void TriMesh::BuildOBBRotatingCalipers()
         switch ( minSideIndex )
         {
         case 0:
-            obb.midAxis = newDir1;
-            obb.minAxis = newDir2;
+            midAxis = newDir1;
+            minAxis = newDir2;
             break;
         case 1:
-            obb.minAxis = newDir1;
-            obb.maxAxis = newDir2;
+            minAxis = newDir1;
+            maxAxis = newDir2;
             break;
         case 2:
-            obb.maxAxis = newDir1;
-            obb.midAxis = newDir2;
+            maxAxis = newDir1;
+            midAxis = newDir2;
             break;
         }
 
 
         OBB nobb;
-        nobb.origin = obb.origin;
-        nobb.maxAxis = obb.maxAxis;
-        nobb.midAxis = obb.midAxis;
-        nobb.minAxis = obb.minAxis;
-        for( VertexIter vit=vertices_begin(); vit!=vertices_end(); ++vit ) {
-            Vec3d v = point( *vit );
+        nobb.origin = origin;
+        nobb.maxAxis = maxAxis;
+        nobb.midAxis = midAxis;
+        nobb.minAxis = minAxis;
+        for( unsigned int k=0; k<points.size(); k++ ) {
+            Vec3d v = points[k];
             nobb.Insert_A_Point( v );
         }
 
-        obb = nobb;
-        obb.OrderAxis();
-        obb.MoveOriginToMiddilePoint();
+        *this = nobb;
+        OrderAxis();
+        MoveOriginToMiddilePoint();
 
         return;
     }
@@ -415,11 +540,11 @@ void TriMesh::BuildOBBRotatingCalipers()
     for( int i=0; i<3; i++ ) {
 
         vector<Vec2d> projPts;
-        for( VertexIter vit=vertices_begin(); vit!=vertices_end(); ++vit ) {
-            Vec3d v = point( *vit );
+        for( unsigned int k=0; k<points.size(); k++ ) {
+            Vec3d v = points[k];
             Vec2d projV;
-            projV[0] = (v-obb.origin) | dir[(i+1)%3];
-            projV[1] = (v-obb.origin) | dir[(i+2)%3];
+            projV[0] = (v-origin) | dir[(i+1)%3];
+            projV[1] = (v-origin) | dir[(i+2)%3];
             projPts.push_back( projV );
         }
 
@@ -446,32 +571,32 @@ void TriMesh::BuildOBBRotatingCalipers()
     switch ( minIndex )
     {
     case 0:
-        obb.midAxis = newDir1;
-        obb.minAxis = newDir2;
+        midAxis = newDir1;
+        minAxis = newDir2;
         break;
     case 1:
-        obb.minAxis = newDir1;
-        obb.maxAxis = newDir2;
+        minAxis = newDir1;
+        maxAxis = newDir2;
         break;
     case 2:
-        obb.maxAxis = newDir1;
-        obb.midAxis = newDir2;
+        maxAxis = newDir1;
+        midAxis = newDir2;
         break;
     }
 
     OBB nobb;
-    nobb.origin = obb.origin;
-    nobb.maxAxis = obb.maxAxis;
-    nobb.midAxis = obb.midAxis;
-    nobb.minAxis = obb.minAxis;
-    for( VertexIter vit=vertices_begin(); vit!=vertices_end(); ++vit ) {
-        Vec3d v = point( *vit );
+    nobb.origin = origin;
+    nobb.maxAxis = maxAxis;
+    nobb.midAxis = midAxis;
+    nobb.minAxis = minAxis;
+    for( unsigned int k=0; k<points.size(); k++ ) {
+        Vec3d v = points[k];
         nobb.Insert_A_Point( v );
     }
 
-    obb = nobb;
-    obb.OrderAxis();
-    obb.MoveOriginToMiddilePoint();
+    *this = nobb;
+    OrderAxis();
+    MoveOriginToMiddilePoint();
 }
 
 void TriMesh::OBB::Insert_A_Point(const Point& p)
@@ -9,12 +9,15 @@
 namespace bwabstraction
 {
 
+class BinaryMesh;
+
 class TriMesh : public MyTriMesh
 {
 
 public:
 
     bool LoadOBJ(std::string file);
+    bool LoadBWM(const BinaryMesh &file);
     bool LoadOM(std::string file);
     void SaveOBJ(std::string file);
     void SaveOM(std::string file);
@@ -28,8 +31,6 @@ public:
     void RotateNoNormalUpdate(const Point& center, const Point& axis, double radian);
     void RotateNoNormalUpdate(const Point& center, const Eigen::Matrix3d& R);
     void BuildOBB();
-    void BuildOBBPCA();
-    void BuildOBBRotatingCalipers();
 
     struct OBB
     {
@@ -42,6 +43,9 @@ public:
         Point minAxis;
 
         OBB();
+        void Build(const std::vector<Point> &points);
+        void BuildPCA(const std::vector<Point> &points);
+        void BuildRotatingCalipers(const std::vector<Point> &points);
         void Insert_A_Point(const Point& p);
         void MoveOriginToMiddilePoint();
         void OrderAxis();
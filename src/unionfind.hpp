@@ -0,0 +1,116 @@
+#ifndef UNIONFIND_H
+#define UNIONFIND_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace bwabstraction
+{
+
+/**
+ * @brief The UnionFind class is a disjoint-set forest over the elements [0, size) that several
+ * threads can merge at the same time without locks. A set is always linked below the smaller
+ * root, so every root is the smallest element of its set and the result does not depend on the
+ * order of the merges or on the number of threads.
+ */
+class UnionFind
+{
+
+public:
+
+    UnionFind() : parents(NULL), capacity(0) {}
+
+    ~UnionFind()
+    {
+        delete[] parents;
+    }
+
+    UnionFind(const UnionFind&) = delete;
+    UnionFind& operator=(const UnionFind&) = delete;
+
+    // make every element of [0, size) a singleton. the storage is reused between calls.
+    void Reset(int size)
+    {
+        if (size > capacity)
+        {
+            delete[] parents;
+            parents = new std::atomic<int>[size];
+            capacity = size;
+        }
+        #pragma omp parallel for
+        for (int i = 0; i < size; ++i)
+        {
+            parents[i].store(i, std::memory_order_relaxed);
+        }
+    }
+
+    int Find(int x)
+    {
+        int parent = parents[x].load(std::memory_order_relaxed);
+        while (parent != x)
+        {
+            // path halving. parents only move up the tree, so losing the race to another thread
+            // still leaves a valid ancestor in place.
+            int grandparent = parents[parent].load(std::memory_order_relaxed);
+            if (grandparent != parent)
+            {
+                parents[x].compare_exchange_weak(parent, grandparent, std::memory_order_relaxed);
+            }
+            x = grandparent;
+            parent = parents[x].load(std::memory_order_relaxed);
+        }
+        return x;
+    }
+
+    // thread-safe merge, returns false if a and b were already in the same set
+    bool Unite(int a, int b)
+    {
+        while (true)
+        {
+            a = Find(a);
+            b = Find(b);
+            if (a == b)
+            {
+                return false;
+            }
+            if (a < b)
+            {
+                std::swap(a, b);
+            }
+            // fails if another thread linked a meanwhile, then retry from the new roots
+            int expected = a;
+            if (parents[a].compare_exchange_strong(expected, b, std::memory_order_acq_rel))
+            {
+                return true;
+            }
+        }
+    }
+
+    // merge without atomic read-modify-write. only valid while no other thread touches the two sets.
+    bool UniteExclusive(int a, int b)
+    {
+        a = Find(a);
+        b = Find(b);
+        if (a == b)
+        {
+            return false;
+        }
+        if (a < b)
+        {
+            std::swap(a, b);
+        }
+        parents[a].store(b, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+
+    std::atomic<int>* parents;
+    int capacity;
+
+};
+
+} // namespace bwabstraction
+
+#endif // UNIONFIND_H
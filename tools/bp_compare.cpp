@@ -0,0 +1,198 @@
+// Compares BinaryBeliefPropagation with the opengm model that BWAbstraction used before.
+// Both solve the same random models shaped like those of BeliefPropagationOptimization():
+// patches on a grid with a background term, a three-variable factor per boundary and pairwise
+// similarity factors. The labels of both must match exactly.
+//
+// usage: bwa_bp_compare [models] [seed]
+
+#include <belief_propagation.hpp>
+#include <opengm/graphicalmodel/space/simplediscretespace.hxx>
+#include <opengm/operations/adder.hxx>
+#include <opengm/graphicalmodel/graphicalmodel.hxx>
+#include <opengm/inference/messagepassing/messagepassing.hxx>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+struct Factor
+{
+    vector<int> variables;
+    vector<float> values;
+};
+
+// the factors in the order of BeliefPropagationOptimization(): similarity, background, boundaries
+void RandomModel(mt19937 &rng, int &numVariables, vector<Factor> &factors)
+{
+    uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    lognormal_distribution<float> lognormal(0.0f, 1.0f);
+    const int width = 10 + rng() % 15;
+    const int height = 10 + rng() % 15;
+    const int numPatches = width * height;
+
+    vector<float> areas(numPatches);
+    float areaSum = 0.0f;
+    for (int i = 0; i < numPatches; ++i)
+    {
+        areas[i] = lognormal(rng);
+        areaSum += areas[i];
+    }
+    for (int i = 0; i < numPatches; ++i)
+    {
+        areas[i] *= 0.6f / areaSum;
+    }
+
+    vector<pair<int, int> > boundaries;
+    for (int i = 0; i < numPatches; ++i)
+    {
+        if (i % width + 1 < width)
+        {
+            boundaries.push_back(pair<int, int>(i, i + 1));
+        }
+        if (i / width + 1 < height)
+        {
+            boundaries.push_back(pair<int, int>(i, i + width));
+        }
+    }
+    numVariables = numPatches + static_cast<int>(boundaries.size());
+    factors.clear();
+
+    // similarity sets of 2 to 12 patches over half of the patches
+    vector<int> order(numPatches);
+    for (int i = 0; i < numPatches; ++i)
+    {
+        order[i] = i;
+    }
+    shuffle(order.begin(), order.end(), rng);
+    const float consistencyWeight = 50.0f * uniform(rng);
+    for (int k = 0; k < numPatches / 2;)
+    {
+        const int size = 2 + rng() % 11;
+        vector<int> set(order.begin() + k, order.begin() + min(k + size, numPatches));
+        k += size;
+        for (size_t i = 0; i < set.size(); ++i)
+        {
+            for (size_t j = i + 1; j < set.size(); ++j)
+            {
+                const int p0 = min(set[i], set[j]);
+                const int p1 = max(set[i], set[j]);
+                const float m_a = min(areas[p0], areas[p1]) * consistencyWeight;
+                Factor f;
+                f.variables = { p0, p1 };
+                f.values = { m_a, -m_a, -m_a, m_a };
+                factors.push_back(f);
+            }
+        }
+    }
+
+    for (int i = 0; i < numPatches; ++i)
+    {
+        const bool border = i % width == 0 || i / width == 0 || i % width == width - 1 || i / width == height - 1;
+        const float l = (border || uniform(rng) < 0.1f ? uniform(rng) * 0.3f : 0.0f) * areas[i] * 250.0f;
+        Factor f;
+        f.variables = { i };
+        f.values = { l, 0.0f };
+        factors.push_back(f);
+    }
+
+    for (size_t c = 0; c < boundaries.size(); ++c)
+    {
+        const int q1 = boundaries[c].first;
+        const int q2 = boundaries[c].second;
+        const float lt = (0.01f + uniform(rng) * 0.2f) * min(areas[q1], areas[q2]);
+        const float dt = uniform(rng);
+        const float merge = 0.00000001f * 50.0f;
+        const float contrast = uniform(rng) * lt * (1 - dt) * 50.0f;
+        const float line = uniform(rng) * lt * max(0.01f, dt) * 50.0f;
+        Factor f;
+        f.variables = { q1, q2, numPatches + static_cast<int>(c) };
+        // f(x0, x1, x2) at x0 + 2 * x1 + 4 * x2
+        f.values = { merge, contrast, contrast, merge, line, 0.0f, 0.0f, line };
+        factors.push_back(f);
+    }
+}
+
+void SolveOpenGM(int numVariables, const vector<Factor> &factors, vector<int> &labels)
+{
+    typedef opengm::SimpleDiscreteSpace<int, int> Space;
+    typedef opengm::GraphicalModel<float, opengm::Adder, opengm::ExplicitFunction<float>, Space> Model;
+    typedef opengm::BeliefPropagationUpdateRules<Model, opengm::Maximizer> UpdateRules;
+    typedef opengm::MessagePassing<Model, opengm::Maximizer, UpdateRules, opengm::MaxDistance> BeliefPropagation;
+
+    Space space(numVariables, 2);
+    Model model(space);
+    for (auto it = factors.begin(); it != factors.end(); ++it)
+    {
+        const size_t arity = it->variables.size();
+        const size_t shape[] = { 2, 2, 2 };
+        opengm::ExplicitFunction<float> f(shape, shape + arity, 0.0f);
+        for (size_t c = 0; c < it->values.size(); ++c)
+        {
+            size_t x[3];
+            for (size_t j = 0; j < arity; ++j)
+            {
+                x[j] = (c >> j) & 1;
+            }
+            f(x) = it->values[c];
+        }
+        Model::FunctionIdentifier fid = model.addFunction(f);
+        model.addFactor(fid, it->variables.begin(), it->variables.end());
+    }
+
+    BeliefPropagation::Parameter parameter(40, 1e-20f, 0.0f);
+    BeliefPropagation bp(model, parameter);
+    bp.infer();
+    bp.arg(labels);
+}
+
+void SolveBinary(bwabstraction::BinaryBeliefPropagation &solver, int numVariables, const vector<Factor> &factors,
+                 vector<int> &labels)
+{
+    solver.Reset(numVariables);
+    for (auto it = factors.begin(); it != factors.end(); ++it)
+    {
+        const int* v = it->variables.data();
+        const float* f = it->values.data();
+        switch (it->variables.size())
+        {
+        case 1: solver.AddFactor(v[0], f); break;
+        case 2: solver.AddFactor(v[0], v[1], f); break;
+        default: solver.AddFactor(v[0], v[1], v[2], f); break;
+        }
+    }
+    solver.Infer(40, 1e-20f, labels);
+}
+
+int main(int argc, char** argv)
+{
+    const int numModels = argc > 1 ? atoi(argv[1]) : 200;
+    mt19937 rng(argc > 2 ? atoi(argv[2]) : 1);
+    bwabstraction::BinaryBeliefPropagation solver;
+    int identical = 0;
+    long long differing = 0;
+    long long total = 0;
+    for (int i = 0; i < numModels; ++i)
+    {
+        int numVariables;
+        vector<Factor> factors;
+        RandomModel(rng, numVariables, factors);
+        vector<int> expected;
+        vector<int> labels;
+        SolveOpenGM(numVariables, factors, expected);
+        SolveBinary(solver, numVariables, factors, labels);
+        int d = 0;
+        for (int v = 0; v < numVariables; ++v)
+        {
+            d += labels[v] != expected[v];
+        }
+        identical += d == 0;
+        differing += d;
+        total += numVariables;
+    }
+    cout << identical << " of " << numModels << " models labeled identically, "
+         << differing << " of " << total << " labels differ" << endl;
+    return identical == numModels ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -38,9 +38,14 @@ int main(int argc, char *argv[])
         ("featureWeight", "Optional. Weight of feature term.", cxxopts::value<float>())
         ("congruentThreshold", "Optional. Threshold of congruency between mesh components.", cxxopts::value<float>())
         ("patchSizeThreshold", "Optional. Threshold of minimal patch size in pixels.", cxxopts::value<int>())
+        ("sharpEdgeAngle", "Optional. Minimal dihedral angle of sharp edges in degrees.", cxxopts::value<float>())
         ("v,verbose", "Optional. Verbose mode.", cxxopts::value<bool>()->implicit_value("true"))
         ("renderWidth", "Optional. Render width in pixels.", cxxopts::value<int>())
-        ("renderHeight", "Optional. Render height in pixels.", cxxopts::value<int>());
+        ("renderHeight", "Optional. Render height in pixels.", cxxopts::value<int>())
+        ("contextBackend", "Optional. OpenGL context backend: glfw, egl or osmesa.", cxxopts::value<string>())
+        ("rasterizer", "Optional. Rasterizer: opengl or software (no OpenGL needed).", cxxopts::value<string>())
+        ("numThreads", "Optional. Number of OpenMP threads, default uses all cores.", cxxopts::value<int>())
+        ("cacheDirectory", "Optional. Directory to cache the model precompute in.", cxxopts::value<string>());
 
     // designate "input", "camera" and "output" as positional arguments
     options.parse_positional({"input", "camera", "output"});
@@ -95,6 +100,10 @@ int main(int argc, char *argv[])
         {
             param.patchSizeThreshold = args["patchSizeThreshold"].as<int>();
         }
+        if (args.count("sharpEdgeAngle"))
+        {
+            param.sharpEdgeAngle = args["sharpEdgeAngle"].as<float>();
+        }
         if (args.count("verbose"))
         {
             param.verbose = args["verbose"].as<bool>();
@@ -107,6 +116,52 @@ int main(int argc, char *argv[])
         {
             param.renderHeight = args["renderHeight"].as<int>();
         }
+        if (args.count("contextBackend"))
+        {
+            string backend = args["contextBackend"].as<string>();
+            if (backend == "egl")
+            {
+                param.contextBackend = bwabstraction::ContextBackend::EGL;
+            }
+            else if (backend == "osmesa")
+            {
+                param.contextBackend = bwabstraction::ContextBackend::OSMESA;
+            }
+            else if (backend == "glfw")
+            {
+                param.contextBackend = bwabstraction::ContextBackend::GLFW;
+            }
+            else
+            {
+                cout << "Unknown contextBackend '" << backend << "', expected glfw, egl or osmesa." << endl;
+                exit(1);
+            }
+        }
+        if (args.count("numThreads"))
+        {
+            param.numThreads = args["numThreads"].as<int>();
+        }
+        if (args.count("cacheDirectory"))
+        {
+            param.cacheDirectory = args["cacheDirectory"].as<string>();
+        }
+        if (args.count("rasterizer"))
+        {
+            string rasterizer = args["rasterizer"].as<string>();
+            if (rasterizer == "software")
+            {
+                param.rasterizer = bwabstraction::Rasterizer::SOFTWARE;
+            }
+            else if (rasterizer == "opengl")
+            {
+                param.rasterizer = bwabstraction::Rasterizer::OPENGL;
+            }
+            else
+            {
+                cout << "Unknown rasterizer '" << rasterizer << "', expected opengl or software." << endl;
+                exit(1);
+            }
+        }
 
         // load camera file and input file, run the algorithm, then save result image as output file
         param.LoadMVPMatrixFromFile(args["camera"].as<string>());
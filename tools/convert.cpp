@@ -0,0 +1,74 @@
+// Converts models to the binary .bwm format read by BWAbstraction::LoadModel().
+
+#include <bwabstraction.hpp>
+#include <cxxopts.hpp>
+#include <iostream>
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+    // create cxxopts instance
+    cxxopts::Options options(argv[0], " - convert a model to the BWAbstraction binary mesh format");
+
+    // add positional argument help text
+    options
+        .positional_help("input.obj output.bwm")
+        .show_positional_help();
+
+    options.add_options()
+        ("h,help", "Optional. Print help.")
+        ("input", "Positional. Required. 3D model file to be converted.", cxxopts::value<string>())
+        ("output", "Positional. Required. Output .bwm file name.", cxxopts::value<string>())
+        ("meshOnly", "Optional. Leave out the component IDs and sharp edges.", cxxopts::value<bool>()->implicit_value("true"))
+        ("v,verbose", "Optional. Verbose mode.", cxxopts::value<bool>()->implicit_value("true"))
+        ("numThreads", "Optional. Number of OpenMP threads, default uses all cores.", cxxopts::value<int>());
+
+    // designate "input" and "output" as positional arguments
+    options.parse_positional({"input", "output"});
+
+    // parse argument, get result object args
+    try
+    {
+        auto args = options.parse(argc, argv);
+
+        // if h/help option is used, print help and exit
+        if (args.count("h"))
+        {
+            cout << options.help({ "" }) << endl;
+            exit(0);
+        }
+
+        // the precompute runs on the CPU only, no OpenGL context is needed
+        bwabstraction::Parameters param;
+        param.rasterizer = bwabstraction::Rasterizer::SOFTWARE;
+        if (args.count("verbose"))
+        {
+            param.verbose = args["verbose"].as<bool>();
+        }
+        if (args.count("numThreads"))
+        {
+            param.numThreads = args["numThreads"].as<int>();
+        }
+        bool meshOnly = args.count("meshOnly") && args["meshOnly"].as<bool>();
+
+        bwabstraction::BWAbstraction bwa;
+        if (!bwa.LoadModel(args["input"].as<string>(), param))
+        {
+            return 1;
+        }
+        if (!bwa.SaveBinaryModel(args["output"].as<string>(), !meshOnly))
+        {
+            cout << "SaveBinaryModel() failed." << endl;
+            return 1;
+        }
+    }
+    catch (cxxopts::OptionException ex)
+    {
+        // if the user missed any positional argument, an OptionException is thrown
+        cout << ex.what() << endl;
+        exit(1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+// Compares SurfaceLabeling with the sequential flood fill that BWAbstraction used before.
+// Both label random triangle ID maps over random faces, so that many adjacent pixels show
+// faces that are not connected, also inside one patch. The patches and the depth critical
+// pixels of both must match exactly.
+//
+// usage: bwa_labeling_compare [maps] [seed]
+
+#include <surface_labeling.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+static const int neighbors[] =
+{
+    -1, 0,
+    1, 0,
+    0, -1,
+    0, 1
+};
+
+// the flood fill of the baseline TriangleSurfaceConnectFloodfill(), patches numbered in seed order
+void FloodFill(const vector<int> &triangleIDs, int width, int height, const vector<int> &faceVertices,
+               vector<int> &patchIDs, vector<char> &depthCritLines)
+{
+    patchIDs.assign(width * height, -1);
+    depthCritLines.assign(width * height, 0);
+    int numPatches = 0;
+    queue<int> neighborQueue;
+    for (int seed = 0; seed < width * height; ++seed)
+    {
+        if (triangleIDs[seed] == -1 || patchIDs[seed] != -1)
+        {
+            continue;
+        }
+        neighborQueue.push(seed);
+        patchIDs[seed] = numPatches;
+        while (!neighborQueue.empty())
+        {
+            int p = neighborQueue.front();
+            neighborQueue.pop();
+            int id = triangleIDs[p];
+            for (int n = 0; n < 4; ++n)
+            {
+                int nrow = p / width + neighbors[2 * n];
+                int ncol = p % width + neighbors[2 * n + 1];
+                if (nrow < 0 || ncol < 0 || nrow >= height || ncol >= width)
+                {
+                    continue;
+                }
+                int np = nrow * width + ncol;
+                if (triangleIDs[np] == -1 || patchIDs[np] != -1)
+                {
+                    continue;
+                }
+                if (bwabstraction::SurfaceLabeling::SurfaceConnected(faceVertices.data(), id, triangleIDs[np]))
+                {
+                    neighborQueue.push(np);
+                    patchIDs[np] = numPatches;
+                }
+                else
+                {
+                    depthCritLines[p] = 1;
+                }
+            }
+        }
+        ++numPatches;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int numMaps = argc > 1 ? atoi(argv[1]) : 3000;
+    mt19937 rng(argc > 2 ? atoi(argv[2]) : 1);
+    bwabstraction::SurfaceLabeling labeling;
+    int mismatches = 0;
+    for (int i = 0; i < numMaps; ++i)
+    {
+        // small maps and a few taller than the labeling bands
+        const int width = 3 + rng() % (i % 10 == 0 ? 200 : 20);
+        const int height = 3 + rng() % (i % 10 == 0 ? 200 : 20);
+        const int numFaces = 2 + rng() % 8;
+        const int numVertices = 3 + rng() % 12;
+        vector<int> faceVertices(numFaces * 3);
+        for (auto it = faceVertices.begin(); it != faceVertices.end(); ++it)
+        {
+            *it = rng() % numVertices;
+        }
+        vector<int> triangleIDs(width * height);
+        for (auto it = triangleIDs.begin(); it != triangleIDs.end(); ++it)
+        {
+            *it = rng() % 5 == 0 ? -1 : static_cast<int>(rng() % numFaces);
+        }
+
+        vector<int> expectedPatchIDs;
+        vector<char> expectedDepthCritLines;
+        FloodFill(triangleIDs, width, height, faceVertices, expectedPatchIDs, expectedDepthCritLines);
+
+        vector<int> roots;
+        vector<char> depthCritLines(width * height, 0);
+        labeling.Label(triangleIDs.data(), width, height, faceVertices.data(), roots, depthCritLines.data());
+        // number the patches by their roots, in scan order like the seeds of the flood fill
+        vector<int> rootPatch(width * height, -1);
+        vector<int> patchIDs(width * height, -1);
+        int numPatches = 0;
+        for (int p = 0; p < width * height; ++p)
+        {
+            if (roots[p] == -1)
+            {
+                continue;
+            }
+            if (rootPatch[roots[p]] == -1)
+            {
+                rootPatch[roots[p]] = numPatches++;
+            }
+            patchIDs[p] = rootPatch[roots[p]];
+        }
+
+        if (patchIDs != expectedPatchIDs || depthCritLines != expectedDepthCritLines)
+        {
+            ++mismatches;
+        }
+    }
+    cout << mismatches << " of " << numMaps << " maps differ from the flood fill" << endl;
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -20,6 +20,13 @@ BWARenderer::BWARenderer(QWidget *parent) :
     timer.start(16);
 
     bwaParam.useHostOpenGL = true;
+    bwaParam.incrementalOptimization = true;
+}
+
+BWARenderer::~BWARenderer()
+{
+    // bwa deletes its OpenGL objects on the current context when it is destroyed after this
+    makeCurrent();
 }
 
 void BWARenderer::TimerUpdate()
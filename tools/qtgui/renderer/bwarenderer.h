@@ -15,6 +15,7 @@ class BWARenderer : public MyRenderer
 public:
 
     BWARenderer(QWidget *parent = NULL);
+    ~BWARenderer();
 
     enum class BackgroundColor
     {